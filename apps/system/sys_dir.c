@@ -5,25 +5,13 @@
 
 /* Author: Yunhao Zhang
  * Description: the directory system server
- * handling requests to directory lookup, insertion, etc.
+ * Directories are resolved by GPID_FILE directly on its inode store (see
+ * library/file/dir.c), so GPID_DIR only forwards the requests of clients
+ * still sending them to GPID_DIR.
  */
 
 #include "app.h"
 #include <string.h>
-#include <stdlib.h>
-
-/* To understand directory management, read tools/mkfs.c */
-int dir_do_lookup(int dir_ino, char* name) {
-    char buf[BLOCK_SIZE];
-    file_read(dir_ino, 0, buf);
-
-    for (int i = 0, namelen = strlen(name); i < strlen(buf) - namelen; i++)
-        if (!strncmp(name, buf + i, namelen) &&
-            buf[i + namelen] == ' ' && (i == 0 || buf[i - 1] == ' '))
-            return atoi(buf + i + namelen);
-
-    return -1;
-}
 
 int main() {
     SUCCESS("Enter kernel process GPID_DIR");
@@ -42,12 +30,19 @@ int main() {
 
         switch (req->type) {
         case DIR_LOOKUP:
-            reply->ino = dir_do_lookup(req->ino, req->name);
+            reply->ino = dir_lookup(req->ino, req->name);
+            reply->status = reply->ino == -1? DIR_ERROR : DIR_OK;
+            grass->sys_send(sender, (void*)reply, sizeof(*reply));
+            break;
+        case DIR_LOOKUP_PATH:
+            req->path[DIR_PATH_SIZE - 1] = 0;
+            reply->ino = dir_lookup_path(req->ino, req->path);
             reply->status = reply->ino == -1? DIR_ERROR : DIR_OK;
             grass->sys_send(sender, (void*)reply, sizeof(*reply));
             break;
         case DIR_INSERT: case DIR_REMOVE: default:
-            /* This part is left to students as an exercise */
+            /* This part is left to students as an exercise; GPID_FILE
+             * must call dcache_invalidate() for the name */
             FATAL("sys_dir: request%d not implemented", req->type);
         }
     }
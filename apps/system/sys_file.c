@@ -5,19 +5,339 @@
 
 /* Author: Yunhao Zhang
  * Description: the file (inode) system server
- * handling requests to reading and writing inodes
+ * handling requests to reading and writing inodes, and to resolving names
+ * in directories (see library/file/dir.c)
  */
 
 #include "app.h"
 #include "file.h"
+#include "dir.h"
+#include <stdlib.h>
 #include <string.h>
 
+static inode_intf disk, logdisk, tree, fs;
+
+/* Sequential read-ahead
+ * The last block read of a few recently read inodes is kept in streams[].
+ * A read starting right after the last block read of the same inode is
+ * sequential; after replying to it, the next blocks of the inode are read
+ * into the prefetch buffer, so the next request is answered from there.
+ * A prefetched block that is dropped before being read is wasted.
+ */
+#define FILE_NSTREAMS               4
+#define FILE_PREFETCH_NBLOCKS       8
+#define FILE_PREFETCH_NBLOCKS_ARTY  2
+
+static struct stream
+{
+    int ino;
+    unsigned int next, last_use;
+} streams[FILE_NSTREAMS];
+static unsigned int stream_clock;
+
+static struct prefetch
+{
+    int ino;
+    unsigned int offset, nblocks, max_nblocks;
+    char *used;
+    block_t *blocks;
+} pf = {.ino = -1};
+
+static struct file_stats stats;
+
+static void prefetch_drop()
+{
+    for (int i = 0; i < pf.nblocks; i++)
+        if (!pf.used[i])
+            stats.wasted++;
+    pf.ino = -1;
+    pf.nblocks = 0;
+}
+
+/* Return whether reading nblocks from offset continues a stream */
+static int stream_update(int ino, unsigned int offset, unsigned int nblocks)
+{
+    struct stream *victim = &streams[0];
+    for (int i = 0; i < FILE_NSTREAMS; i++)
+    {
+        if (streams[i].ino == ino && streams[i].last_use)
+        {
+            int sequential = (streams[i].next == offset);
+            streams[i].next = offset + nblocks;
+            streams[i].last_use = ++stream_clock;
+            return sequential;
+        }
+        if (streams[i].last_use < victim->last_use)
+            victim = &streams[i];
+    }
+
+    victim->ino = ino;
+    victim->next = offset + nblocks;
+    victim->last_use = ++stream_clock;
+    return 0;
+}
+
+/* Read nblocks from offset, from the prefetch buffer where possible */
+static int file_get(int ino, unsigned int offset, unsigned int nblocks, block_t *blocks)
+{
+    for (unsigned int i = 0; i < nblocks; )
+    {
+        if (pf.ino == ino && offset + i >= pf.offset && offset + i < pf.offset + pf.nblocks)
+        {
+            unsigned int j = offset + i - pf.offset;
+            memcpy(&blocks[i], &pf.blocks[j], BLOCK_SIZE);
+            if (!pf.used[j]) stats.hits++;
+            pf.used[j] = 1;
+            i++;
+            continue;
+        }
+
+        /* Read the rest up to the prefetched blocks, if any */
+        unsigned int n = nblocks - i;
+        if (pf.ino == ino && offset + i < pf.offset && offset + nblocks > pf.offset)
+            n = pf.offset - (offset + i);
+        if (fs->readv(fs, ino, offset + i, &blocks[i], n) < 0)
+            return -1;
+        i += n;
+    }
+    return 0;
+}
+
+/* Prefetch the blocks after a sequential read of nblocks from offset */
+static void file_readahead(int ino, unsigned int offset, unsigned int nblocks)
+{
+    if (!stream_update(ino, offset, nblocks))
+        return;
+
+    unsigned int next = offset + nblocks;
+    if (pf.ino == ino && next >= pf.offset && next < pf.offset + pf.nblocks)
+        return; /* still ahead of the client */
+
+    int size = fs->getsize(fs, ino);
+    if (size <= 0 || next >= size)
+        return;
+
+    prefetch_drop();
+    unsigned int n = (size - next < pf.max_nblocks) ? size - next : pf.max_nblocks;
+    if (fs->readv(fs, ino, next, pf.blocks, n) < 0)
+        return;
+    pf.ino = ino;
+    pf.offset = next;
+    pf.nblocks = n;
+    memset(pf.used, 0, n);
+    stats.prefetched += n;
+}
+
+/* Reply to FILE_READV with the first block in a file_reply and the other
+ * blocks in full messages; return -1 if only an error was sent
+ */
+static int file_readv_reply(int sender, int ino, int size, int offset, int nblocks, char *buf)
+{
+    struct file_reply *reply = (void *)buf;
+    if (nblocks < 1 || nblocks > FILE_READV_NBLOCKS || offset + nblocks > size ||
+        file_get(ino, offset, 1, &reply->block) < 0)
+    {
+        reply->status = FILE_ERROR;
+        reply->nblocks = 0;
+        grass->sys_send(sender, (void *)reply, sizeof(*reply));
+        return -1;
+    }
+    reply->status = FILE_OK;
+    reply->nblocks = nblocks;
+    grass->sys_send(sender, (void *)reply, sizeof(*reply));
+
+    for (int i = 1; i < nblocks; i += FILE_READV_MSG_NBLOCKS)
+    {
+        int n = (nblocks - i < FILE_READV_MSG_NBLOCKS) ? nblocks - i : FILE_READV_MSG_NBLOCKS;
+        if (file_get(ino, offset + i, n, (block_t *)buf) < 0)
+            FATAL("sys_file: readv ino=%d offset=%d failed", ino, offset + i);
+        grass->sys_send(sender, buf, n * BLOCK_SIZE);
+    }
+    return 0;
+}
+
+/* Open files
+ * A handle returned by FILE_OPEN keeps the inode number, the size and the
+ * position of the next block for FILE_READ_NEXT, so a reader does not send
+ * offsets and the size is not looked up again for every request.  Blocks
+ * are mapped by the inode store, whose inode blocks and recent indirect
+ * blocks are resident.  Only the process opening a file can use the handle,
+ * and the handles of a process are closed at FILE_EXIT when it is freed.
+ */
+#define FILE_NHANDLES  16
+static struct handle
+{
+    int owner; /* pid of the process, 0 if the handle is free */
+    int ino;
+    unsigned int size, pos;
+} handles[FILE_NHANDLES];
+
+static struct handle *handle_get(int sender, int fd)
+{
+    if (fd < 0 || fd >= FILE_NHANDLES || handles[fd].owner != sender)
+        return NULL;
+    return &handles[fd];
+}
+
+static int handle_open(int sender, int ino)
+{
+    int size = fs->getsize(fs, ino);
+    if (size < 0)
+        return -1;
+
+    for (int fd = 0; fd < FILE_NHANDLES; fd++)
+        if (handles[fd].owner == 0)
+        {
+            handles[fd].owner = sender;
+            handles[fd].ino = ino;
+            handles[fd].size = size;
+            handles[fd].pos = 0;
+            return fd;
+        }
+    return -1;
+}
+
+/* Close the handles of process pid, or of all user apps if pid is -1 */
+static void handle_exit(int pid)
+{
+    for (int fd = 0; fd < FILE_NHANDLES; fd++)
+        if (pid == -1 ? handles[fd].owner >= GPID_USER_START : handles[fd].owner == pid)
+            handles[fd].owner = 0;
+}
+
+/* Reply to FILE_READ_NEXT like to FILE_READV and advance the position */
+static void handle_read_next(int sender, int fd, int nblocks, char *buf)
+{
+    struct file_reply *reply = (void *)buf;
+    struct handle *h = handle_get(sender, fd);
+    if (h == NULL || h->pos >= h->size)
+    {
+        reply->status = FILE_ERROR;
+        reply->nblocks = 0;
+        grass->sys_send(sender, (void *)reply, sizeof(*reply));
+        return;
+    }
+
+    int ino = h->ino, pos = h->pos;
+    if (nblocks > h->size - pos)
+        nblocks = h->size - pos;
+    if (nblocks > FILE_READV_NBLOCKS)
+        nblocks = FILE_READV_NBLOCKS;
+    if (file_readv_reply(sender, ino, h->size, pos, nblocks, buf) < 0)
+        return;
+    h->pos += nblocks;
+    file_readahead(ino, pos, nblocks);
+}
+
+/* Write-back file cache
+ * The inode store is stacked under a second cachedisk, so FILE_WRITE only
+ * updates a cached block of the file.  A write of part of a block reads
+ * the block once, and later small writes to it are coalesced there.  The
+ * inode store and its inode, indirect and bitmap blocks are only updated
+ * when dirty blocks are evicted or flushed, and these updates are in turn
+ * cached by the cachedisk below the inode store until the next sync.
+ * A logdisk is stacked on the disk directly instead and writes a
+ * checkpoint at every sync.
+ * Dirty blocks are synced at FILE_SYNC, when a handle is closed, when a
+ * process exits (FILE_EXIT) and FILE_SYNC_REQUESTS requests after the
+ * first write.  The file server has no timer and only runs on requests,
+ * so a write is not made durable by time: a process that keeps running
+ * after its writes calls file_sync().
+ */
+#define FILE_WCACHE_NBLOCKS       16
+#define FILE_WCACHE_NBLOCKS_ARTY  2
+#define FILE_SYNC_REQUESTS        64
+
+static int dirty;
+static unsigned int nrequests, dirty_since;
+
+static int file_flush()
+{
+    /* Stay dirty if any step fails, so that the flush is retried */
+    if (cachedisk_flush(fs) < 0)
+        return -1;
+    if (logdisk && logdisk_checkpoint(logdisk) < 0)
+        return -1;
+    if (!logdisk && cachedisk_flush(disk) < 0)
+        return -1;
+    dirty = 0;
+    return 0;
+}
+
+/* Forget what sys_file keeps about ino after its blocks or size change */
+static void file_changed(int ino)
+{
+    if (pf.ino == ino)
+        prefetch_drop();
+    dcache_invalidate(ino, NULL);
+
+    int size = fs->getsize(fs, ino);
+    for (int fd = 0; fd < FILE_NHANDLES; fd++)
+        if (handles[fd].owner && handles[fd].ino == ino)
+            handles[fd].size = size;
+
+    if (!dirty)
+        dirty_since = nrequests;
+    dirty = 1;
+}
+
+/* Write len bytes from src at byte start of block offset */
+static int file_put(int ino, unsigned int offset, unsigned int start, unsigned int len, char *src)
+{
+    block_t block;
+    if (offset >= FILE_MAX_NBLOCKS || start > BLOCK_SIZE || len > BLOCK_SIZE - start)
+        return -1;
+
+    if (len < BLOCK_SIZE)
+    {
+        int size = fs->getsize(fs, ino);
+        if (size < 0)
+            return -1;
+        if (offset < size)
+        {
+            if (fs->read(fs, ino, offset, &block) < 0)
+                return -1;
+        }
+        else
+            memset(&block, 0, BLOCK_SIZE);
+    }
+
+    memcpy(block.bytes + start, src, len);
+    if (fs->write(fs, ino, offset, &block) < 0)
+        return -1;
+    file_changed(ino);
+    return 0;
+}
+
 int main()
 {
     SUCCESS("Enter kernel process GPID_FILE");
 
-    /* Initialize the file system interface */
-    inode_intf fs = treedisk_init(fs_disk_init(), 0);
+    /* Initialize the file system interface, for the layout made by mkfs.
+     * The app memory on the Arty board only fits small caches.
+     */
+    int arty = (earth->platform == ARTY);
+    inode_intf raw = fs_disk_init();
+    fs = logdisk = logdisk_init(raw, 0);
+    if (logdisk == NULL)
+    {
+        disk = cachedisk_init(raw, arty ? CACHEDISK_NBLOCKS_ARTY : CACHEDISK_NBLOCKS);
+        fs = extentdisk_init(disk, 0);
+        if (fs == NULL) fs = tree = treedisk_init(disk, 0);
+
+        /* Write back the superblock and bitmap of a file system that has
+         * grown over a larger microSD card when it was opened
+         */
+        if (cachedisk_flush(disk) < 0)
+            FATAL("sys_file: sync failed");
+    }
+    fs = cachedisk_init(fs, arty ? FILE_WCACHE_NBLOCKS_ARTY : FILE_WCACHE_NBLOCKS);
+
+    pf.max_nblocks = arty ? FILE_PREFETCH_NBLOCKS_ARTY : FILE_PREFETCH_NBLOCKS;
+    pf.blocks = malloc(pf.max_nblocks * BLOCK_SIZE);
+    pf.used = malloc(pf.max_nblocks);
+    dcache_init(arty ? DCACHE_NENTRIES_ARTY : DCACHE_NENTRIES);
+    heap_info();
 
     /* Send a notification to GPID_PROCESS */
     char buf[SYSCALL_MSG_LEN];
@@ -27,22 +347,123 @@ int main()
     /* Wait for inode read/write requests */
     while (1)
     {
-        int sender, r;
+        int sender, r, ino, offset, nblocks;
         struct file_request *req = (void *)buf;
         struct file_reply *reply = (void *)buf;
         grass->sys_recv(&sender, buf, SYSCALL_MSG_LEN);
+        nrequests++;
 
+        ino = req->ino;
+        offset = req->offset;
         switch (req->type)
         {
         case FILE_READ:
-            r = fs->read(fs, req->ino, req->offset, (void *)&reply->block);
+            r = file_get(ino, offset, 1, &reply->block);
             reply->status = r == 0 ? FILE_OK : FILE_ERROR;
             grass->sys_send(sender, (void *)reply, sizeof(*reply));
+            if (r == 0)
+                file_readahead(ino, offset, 1);
+            break;
+        case FILE_READV:
+            nblocks = req->nblocks;
+            if (file_readv_reply(sender, ino, fs->getsize(fs, ino), offset, nblocks, buf) == 0)
+                file_readahead(ino, offset, nblocks);
+            break;
+        case FILE_LOOKUP:
+        case FILE_LOOKUP_PATH:
+            req->block.bytes[DIR_PATH_SIZE - 1] = 0;
+            if (req->type == FILE_LOOKUP)
+                reply->ino = dir_resolve(fs, ino, (char *)req->block.bytes);
+            else
+                reply->ino = dir_resolve_path(fs, ino, (char *)req->block.bytes);
+            reply->status = reply->ino < 0 ? FILE_ERROR : FILE_OK;
+            grass->sys_send(sender, (void *)reply, sizeof(*reply));
+            break;
+        case FILE_READDIR:
+            reply->nentries = dir_list(fs, ino, offset, (void *)&reply->block);
+            reply->status = reply->nentries < 0 ? FILE_ERROR : FILE_OK;
+            grass->sys_send(sender, (void *)reply, sizeof(*reply));
+            break;
+        case FILE_OPEN:
+            reply->ino = handle_open(sender, ino);
+            reply->status = reply->ino < 0 ? FILE_ERROR : FILE_OK;
+            if (reply->ino >= 0)
+                reply->nblocks = handles[reply->ino].size;
+            grass->sys_send(sender, (void *)reply, sizeof(*reply));
+            break;
+        case FILE_CLOSE:
+        case FILE_SEEK:
+        {
+            struct handle *h = handle_get(sender, ino);
+            reply->status = h ? FILE_OK : FILE_ERROR;
+            if (h && req->type == FILE_CLOSE)
+                h->owner = 0;
+            if (h && req->type == FILE_CLOSE && dirty && file_flush() < 0)
+                reply->status = FILE_ERROR;
+            if (h && req->type == FILE_SEEK)
+                h->pos = offset;
+            grass->sys_send(sender, (void *)reply, sizeof(*reply));
+            break;
+        }
+        case FILE_READ_NEXT:
+            nblocks = req->nblocks;
+            handle_read_next(sender, ino, nblocks, buf);
+            break;
+        case FILE_STATS:
+            reply->status = FILE_OK;
+            heap_stats(&stats.heap);
+            memcpy(&reply->block, &stats, sizeof(stats));
+            grass->sys_send(sender, (void *)reply, sizeof(*reply));
             break;
         case FILE_WRITE:
+            r = file_put(ino, offset, req->start, req->len, (char *)req->block.bytes);
+            reply->status = r == 0 ? FILE_OK : FILE_ERROR;
+            grass->sys_send(sender, (void *)reply, sizeof(*reply));
+            break;
+        case FILE_SETSIZE:
+            r = req->nblocks > FILE_MAX_NBLOCKS ? -1 : fs->setsize(fs, ino, req->nblocks);
+            if (r >= 0)
+                file_changed(ino);
+            reply->status = r < 0 ? FILE_ERROR : FILE_OK;
+            grass->sys_send(sender, (void *)reply, sizeof(*reply));
+            break;
+        case FILE_SYNC:
+            reply->status = file_flush() == 0 ? FILE_OK : FILE_ERROR;
+            grass->sys_send(sender, (void *)reply, sizeof(*reply));
+            break;
+        case FILE_ALLOC:
+            reply->ino = tree ? treedisk_alloc_inode(tree) : -1;
+            if (reply->ino >= 0)
+                file_changed(reply->ino);
+            reply->status = reply->ino < 0 ? FILE_ERROR : FILE_OK;
+            grass->sys_send(sender, (void *)reply, sizeof(*reply));
+            break;
+        case FILE_FREE:
+            /* Drop the cached blocks of ino before freeing them */
+            r = tree ? fs->setsize(fs, ino, 0) : -1;
+            if (r >= 0)
+                r = treedisk_free_inode(tree, ino);
+            if (r >= 0)
+                file_changed(ino);
+            reply->status = r < 0 ? FILE_ERROR : FILE_OK;
+            grass->sys_send(sender, (void *)reply, sizeof(*reply));
+            break;
+        case FILE_EXIT:
+            if (sender == GPID_PROCESS)
+            {
+                handle_exit(ino);
+                if (dirty && file_flush() < 0)
+                    FATAL("sys_file: sync failed");
+                break;
+            }
+            reply->status = FILE_ERROR;
+            grass->sys_send(sender, (void *)reply, sizeof(*reply));
+            break;
         default:
-            /* This part is left to students as an exercise */
             FATAL("sys_file: request%d not implemented", req->type);
         }
+
+        if (dirty && nrequests - dirty_since >= FILE_SYNC_REQUESTS && file_flush() < 0)
+            FATAL("sys_file: sync failed");
     }
 }
@@ -15,6 +15,7 @@
 static int app_ino, app_pid;
 static void sys_spawn(int base);
 static int app_spawn(struct proc_request *req);
+static void file_exit(int pid);
 
 int main()
 {
@@ -52,6 +53,7 @@ int main()
             break;
         case PROC_EXIT:
             grass->proc_free(sender);
+            file_exit(sender);
 
             if (shell_waiting && app_pid == sender)
                 grass->sys_send(GPID_SHELL, (void *)reply, sizeof(reply));
@@ -60,6 +62,7 @@ int main()
             break;
         case PROC_KILLALL:
             grass->proc_free(-1);
+            file_exit(-1);
             if (shell_waiting)
                 grass->sys_send(GPID_SHELL, (void *)reply, sizeof(reply));
             break;
@@ -69,12 +72,13 @@ int main()
     }
 }
 
-static int app_read(int off, char *dst) { file_read(app_ino, off, dst); }
+static int app_read(int off, int nblocks, char *dst) { return file_readv(app_ino, off, nblocks, dst); }
 
 static int app_spawn(struct proc_request *req)
 {
-    int bin_ino = dir_lookup(0, "bin/");
-    if ((app_ino = dir_lookup(bin_ino, req->argv[0])) < 0)
+    char path[DIR_PATH_SIZE] = "/bin/";
+    strncat(path, req->argv[0], DIR_PATH_SIZE - 6);
+    if ((app_ino = dir_lookup_path(0, path)) < 0)
         return -1;
 
     app_pid = grass->proc_alloc();
@@ -85,12 +89,21 @@ static int app_spawn(struct proc_request *req)
     return 0;
 }
 
+/* Let GPID_FILE close the handles of pid, or of all user apps if pid is -1 */
+static void file_exit(int pid)
+{
+    struct file_request req;
+    req.type = FILE_EXIT;
+    req.ino = pid;
+    grass->sys_send(GPID_FILE, (void *)&req, sizeof(req));
+}
+
 static int sys_proc_base;
 char *sysproc_names[] = {"sys_proc", "sys_file", "sys_dir", "sys_shell"};
 
-static int sys_proc_read(int block_no, char *dst)
+static int sys_proc_read(int block_no, int nblocks, char *dst)
 {
-    return earth->disk_read(sys_proc_base + block_no, 1, dst);
+    return earth->disk_read(sys_proc_base + block_no, nblocks, dst);
 }
 
 static void sys_spawn(int base)
@@ -16,18 +16,22 @@ int main(int argc, char** argv) {
         return -1;
     }
 
-    /* Get the inode number of the file */
-    int file_ino = dir_lookup(grass->workdir_ino, argv[1]);
-    if (file_ino < 0) {
+    static char buf[FSTREAM_NBLOCKS * BLOCK_SIZE];
+    struct fstream f;
+    if (fstream_open(&f, argv[1], buf, FSTREAM_NBLOCKS) < 0) {
         INFO("cat: file %s not found", argv[1]);
         return -1;
     }
 
-    /* Read and print the first block of the file */
-    char buf[BLOCK_SIZE];
-    file_read(file_ino, 0, buf);
-    printf("%s", buf);
-    if (buf[strlen(buf) - 1] != '\n') printf("\r\n");
+    /* Print the file line by line */
+    char line[128];
+    int len = 0;
+    while (fstream_gets(&f, line, sizeof(line))) {
+        printf("%s", line);
+        len = strlen(line);
+    }
+    if (len == 0 || line[len - 1] != '\n') printf("\r\n");
 
+    fstream_close(&f);
     return 0;
 }
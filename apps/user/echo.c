@@ -5,12 +5,39 @@
 
 /* Author: Yunhao Zhang
  * Description: a simple echo
+ * "echo ARGS > FILE" replaces the content of an existing FILE with the
+ * arguments and a newline, and syncs the file system.
  */
 
 #include "app.h"
+#include <string.h>
 
 int main(int argc, char** argv) {
-    for (int i = 1; i < argc; i++) printf("%s ", argv[i]);
-    printf("\r\n");
+    int nargs = argc;
+    if (argc >= 3 && strcmp(argv[argc - 2], ">") == 0) nargs = argc - 2;
+
+    if (nargs == argc) {
+        for (int i = 1; i < argc; i++) printf("%s ", argv[i]);
+        printf("\r\n");
+        return 0;
+    }
+
+    char line[CMD_NARGS * CMD_ARG_LEN + 1] = "";
+    for (int i = 1; i < nargs; i++) {
+        strcat(line, argv[i]);
+        strcat(line, (i < nargs - 1)? " " : "");
+    }
+    strcat(line, "\n");
+
+    char* path = argv[argc - 1];
+    int ino = dir_lookup_path(grass->workdir_ino, path);
+    if (ino < 0) {
+        INFO("echo: file %s not found", path);
+        return -1;
+    }
+    if (file_setsize(ino, 0) < 0 || file_pwrite(ino, 0, strlen(line), line) < 0 || file_sync() < 0) {
+        INFO("echo: cannot write file %s", path);
+        return -1;
+    }
     return 0;
 }
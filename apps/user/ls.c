@@ -16,15 +16,16 @@ int main(int argc, char** argv) {
         return -1;
     }
 
-    /* Read the directory content */
-    char buf[BLOCK_SIZE];
-    file_read(grass->workdir_ino, 0, buf);
-    
-    /* Remove the inode numbers from the string */
-    for (int i = 1; i < strlen(buf); i++)
-        if (buf[i - 1] == ' ' && buf[i] >= '0' && buf[i] <= '9') buf[i] = ' ';
+    /* Print the names in every block of the directory */
+    char name[DIRENT_NAME_LEN + 1];
+    static struct dir_entry entries[DIRENTS_PER_BLOCK];
+    for (int b = 0, n; (n = dir_readdir(grass->workdir_ino, b, entries)) >= 0; b++)
+        for (int i = 0; i < n; i++) {
+            strncpy(name, entries[i].name, DIRENT_NAME_LEN);
+            name[DIRENT_NAME_LEN] = 0;
+            printf("%s ", name);
+        }
+    printf("\r\n");
 
-    /* Print the directory content */
-    printf("%s\r\n", buf);
     return 0;
 }
@@ -28,8 +28,47 @@ struct frame_mapping
     int page_no; /* Which virtual page is the frame mapped to? */
 } table[NFRAMES];
 
+/* Pages mapped to ZERO_FRAME share one all-zero frame and do not own a
+ * physical frame until they are written. The software TLB cannot take
+ * write faults, so the first write is detected when the page is switched
+ * out and only then a private frame is allocated (copy-on-write).
+ * The zero pages of a process are kept in windows of ZERO_WINDOW_NPAGES
+ * aligned pages with one bit per page. The bss and heap of a process are
+ * contiguous, so NZERO_WINDOWS windows hold the zero pages of all the
+ * processes even if every app has the largest image and heap.
+ * Every zero page reserves a free frame, so that the frame it needs
+ * once written can always be allocated in soft_tlb_switch().
+ */
+#define ZERO_WINDOW_NPAGES 32
+#define NZERO_PROC_WINDOWS ((APPS_MAX_SIZE / PAGE_SIZE + MAX_HEAP_NPAGES) / ZERO_WINDOW_NPAGES + 1)
+#define NZERO_WINDOWS (MAX_NPROCESS * NZERO_PROC_WINDOWS)
+struct zero_window
+{
+    int pid;            /* Which process owns the window? */
+    int base;           /* First virtual page of the window */
+    unsigned int pages; /* Bit i for page base + i, 0 if the window is free */
+} zero_table[NZERO_WINDOWS];
+
+/* The zero pages of the process switched out last whose memory is still
+ * all zero; switching in a process does not clear these pages again */
+static struct zero_window zero_mem[NZERO_PROC_WINDOWS];
+
+/* Number of free frames reserved by zero pages */
+static int nreserved;
+
+static int nfree_frames()
+{
+    int nfree = 0;
+    for (int i = 0; i < NFRAMES; i++)
+        nfree += !table[i].use;
+    return nfree;
+}
+
 int mmu_alloc(int *frame_id, void **cached_addr)
 {
+    if (nfree_frames() <= nreserved)
+        FATAL("mmu_alloc: no more available frames");
+
     for (int i = 0; i < NFRAMES; i++)
         if (!table[i].use)
         {
@@ -49,13 +88,75 @@ int mmu_free(int pid)
             paging_invalidate_cache(i);
             memset(&table[i], 0, sizeof(struct frame_mapping));
         }
+
+    for (int i = 0; i < NZERO_WINDOWS; i++)
+        if (zero_table[i].pages && zero_table[i].pid == pid)
+        {
+            nreserved -= __builtin_popcount(zero_table[i].pages);
+            memset(&zero_table[i], 0, sizeof(struct zero_window));
+        }
 }
 
 /* Software TLB Translation */
+static int zero_page_written(int page_no)
+{
+    /* A written page usually differs from zero within its first words;
+     * a page still all zero is read once, which costs less than the
+     * two copies of a private frame in every switch */
+    int *page = (void *)(page_no << 12);
+    for (int i = 0; i < PAGE_SIZE / sizeof(int); i++)
+        if (page[i])
+            return 1;
+    return 0;
+}
+
+static int zero_page_known(int page_no)
+{
+    for (int i = 0; i < NZERO_PROC_WINDOWS; i++)
+        if (zero_mem[i].pages && zero_mem[i].base == (page_no & ~(ZERO_WINDOW_NPAGES - 1)))
+            return (zero_mem[i].pages >> (page_no % ZERO_WINDOW_NPAGES)) & 1;
+    return 0;
+}
+
 int soft_tlb_map(int pid, int page_no, int frame_id)
 {
+    if (frame_id == ZERO_FRAME)
+    {
+        if (nfree_frames() <= nreserved)
+            return -1;
+
+        int base = page_no & ~(ZERO_WINDOW_NPAGES - 1);
+        struct zero_window *free_window = NULL;
+        for (int i = 0; i < NZERO_WINDOWS; i++)
+        {
+            if (zero_table[i].pages && zero_table[i].pid == pid && zero_table[i].base == base)
+            {
+                if (!((zero_table[i].pages >> (page_no % ZERO_WINDOW_NPAGES)) & 1))
+                    nreserved++;
+                zero_table[i].pages |= 1u << (page_no % ZERO_WINDOW_NPAGES);
+                return 0;
+            }
+            if (!zero_table[i].pages && !free_window)
+                free_window = &zero_table[i];
+        }
+        if (free_window)
+        {
+            free_window->pid = pid;
+            free_window->base = base;
+            free_window->pages = 1u << (page_no % ZERO_WINDOW_NPAGES);
+            nreserved++;
+            return 0;
+        }
+
+        /* Give the page a private frame right away */
+        void *cached_addr;
+        mmu_alloc(&frame_id, &cached_addr);
+        memset(cached_addr, 0, PAGE_SIZE);
+    }
+
     table[frame_id].pid = pid;
     table[frame_id].page_no = page_no;
+    return 0;
 }
 
 int soft_tlb_switch(int pid)
@@ -64,6 +165,30 @@ int soft_tlb_switch(int pid)
     if (pid == curr_vm_pid)
         return 0;
 
+    /* Give a private frame to every zero page written by curr_vm_pid and
+     * remember the pages that are still all zero */
+    int nmem = 0;
+    memset(zero_mem, 0, sizeof(zero_mem));
+    for (int i = 0; i < NZERO_WINDOWS; i++)
+    {
+        struct zero_window *w = &zero_table[i];
+        if (!w->pages || w->pid != curr_vm_pid)
+            continue;
+
+        for (int j = 0; j < ZERO_WINDOW_NPAGES; j++)
+            if (((w->pages >> j) & 1) && zero_page_written(w->base + j))
+            {
+                int frame_id;
+                void *cached_addr;
+                nreserved--;
+                mmu_alloc(&frame_id, &cached_addr);
+                soft_tlb_map(curr_vm_pid, w->base + j, frame_id);
+                w->pages &= ~(1u << j);
+            }
+        if (w->pages && nmem < NZERO_PROC_WINDOWS)
+            zero_mem[nmem++] = *w;
+    }
+
     /* Unmap curr_vm_pid from the user address space */
     for (int i = 0; i < NFRAMES; i++)
     {
@@ -82,6 +207,15 @@ int soft_tlb_switch(int pid)
         }
     }
 
+    for (int i = 0; i < NZERO_WINDOWS; i++)
+        if (zero_table[i].pages && zero_table[i].pid == pid)
+            for (int j = 0; j < ZERO_WINDOW_NPAGES; j++)
+            {
+                int page_no = zero_table[i].base + j;
+                if (((zero_table[i].pages >> j) & 1) && !zero_page_known(page_no))
+                    memset((void *)(page_no << 12), 0, PAGE_SIZE);
+            }
+
     curr_vm_pid = pid;
 }
 
@@ -162,7 +296,7 @@ int page_table_map(int pid, int page_no, int frame_id)
      * Feel free to call or modify the two helper functions:
      * pagetable_identity_mapping() and setup_identity_region()
      */
-    soft_tlb_map(pid, page_no, frame_id);
+    return soft_tlb_map(pid, page_no, frame_id);
 
     /* Student's code ends here. */
 }
@@ -20,17 +20,213 @@ enum
 };
 static int type;
 
-int disk_read(int block_no, int nblocks, char *dst)
+/* Asynchronous disk requests
+ * A process submits a request with disk_submit() and polls it with
+ * disk_done() (see proc_disk() in grass/kernel.c). Since the buffer of a
+ * request is in the address space of its process, a block is only
+ * transferred by disk_poll() with the pid of this process. The kernel
+ * itself, i.e., the pager and the boot loader, submits requests with pid
+ * -1 through disk_read() and disk_write(); their buffers are always
+ * mapped, so every disk_poll() serves them.
+ * Among the requests a disk_poll() can serve, the disk service goes in
+ * elevator order: the request with the lowest block number from the disk
+ * head on goes first, wrapping around to the lowest one (C-SCAN). A
+ * request and the pending requests of the same direction that follow it
+ * on the disk are merged into one multi-block run of the SD card, which is
+ * left open afterwards, so that the next request of the following blocks
+ * is served without a new command either. A lone block uses a single-block
+ * command.
+ */
+#define NDISK_REQUESTS (MAX_NPROCESS + 1) /* one per process and the kernel */
+#define DISK_POLL_NBLOCKS 8
+#define DISK_KERNEL -1
+enum
 {
-    if (type == SD_CARD)
+    REQ_FREE,
+    REQ_PENDING,
+    REQ_DONE
+};
+static struct disk_request
+{
+    int status;
+    int pid, write;
+    int block_no, nblocks, ndone;
+    char *buf;
+} requests[NDISK_REQUESTS];
+
+static int run_next = -1; /* next block of the open SD card run */
+static int run_write;
+static int head;          /* block after the last one transferred */
+
+static void disk_run_stop()
+{
+    if (run_next == -1)
+        return;
+
+    if (run_write)
+        sd_write_stop();
+    else
+        sd_read_stop();
+    run_next = -1;
+}
+
+static int disk_servable(struct disk_request *req, int pid)
+{
+    return req->status == REQ_PENDING && (req->pid == pid || req->pid == DISK_KERNEL);
+}
+
+static struct disk_request *disk_schedule(int pid)
+{
+    struct disk_request *next = NULL, *lowest = NULL;
+    for (int i = 0; i < NDISK_REQUESTS; i++)
     {
-        sdread(block_no, nblocks, dst);
+        struct disk_request *req = &requests[i];
+        if (!disk_servable(req, pid))
+            continue;
+
+        /* The request continuing the open run goes first */
+        int pos = req->block_no + req->ndone;
+        if (pos == run_next && req->write == run_write)
+            return req;
+        if (pos >= head && (!next || pos < next->block_no + next->ndone))
+            next = req;
+        if (!lowest || pos < lowest->block_no + lowest->ndone)
+            lowest = req;
     }
-    else
+    return next ? next : lowest;
+}
+
+/* Number of blocks from req on that a run can serve, i.e., the rest of
+ * req and of the pending requests of the same direction right after it */
+static int disk_merge(struct disk_request *req, int pid)
+{
+    int nblocks = req->nblocks - req->ndone;
+    int end = req->block_no + req->nblocks;
+    for (int i = 0; i < NDISK_REQUESTS; i++)
+    {
+        struct disk_request *next = &requests[i];
+        if (next != req && disk_servable(next, pid) && next->write == req->write &&
+            next->block_no + next->ndone == end)
+        {
+            nblocks += next->nblocks - next->ndone;
+            end = next->block_no + next->nblocks;
+            i = -1; /* look for a request after the new end */
+        }
+    }
+    return nblocks;
+}
+
+int disk_poll(int pid)
+{
+    for (int i = 0; i < DISK_POLL_NBLOCKS; i++)
     {
-        char *src = (char *)0x20800000 + block_no * BLOCK_SIZE;
-        memcpy(dst, src, nblocks * BLOCK_SIZE);
+        struct disk_request *req = disk_schedule(pid);
+        if (req == NULL)
+            break;
+
+        int block_no = req->block_no + req->ndone;
+        char *buf = req->buf + req->ndone * BLOCK_SIZE;
+        if (block_no == run_next && req->write == run_write)
+        {
+            if (req->write)
+                sd_write_block(buf);
+            else
+                sd_read_block(buf);
+            run_next++;
+        }
+        else
+        {
+            int nblocks = disk_merge(req, pid);
+            disk_run_stop();
+            if (nblocks == 1)
+            {
+                if (req->write)
+                    sdwrite(block_no, 1, buf);
+                else
+                    sdread(block_no, 1, buf);
+            }
+            else
+            {
+                if (req->write)
+                    sd_write_start(block_no, nblocks);
+                else
+                    sd_read_start(block_no);
+                run_write = req->write;
+                run_next = block_no;
+                continue;
+            }
+        }
+
+        head = block_no + 1;
+        if (++req->ndone == req->nblocks)
+            req->status = REQ_DONE;
     }
+
+    int npending = 0;
+    for (int i = 0; i < NDISK_REQUESTS; i++)
+        npending += (requests[i].status == REQ_PENDING);
+    return npending;
+}
+
+int disk_submit(int pid, int block_no, int nblocks, char *buf, int write)
+{
+    for (int i = 0; i < NDISK_REQUESTS; i++)
+        if (requests[i].status == REQ_FREE)
+        {
+            struct disk_request *req = &requests[i];
+            req->pid = pid;
+            req->write = write;
+            req->block_no = block_no;
+            req->nblocks = nblocks;
+            req->ndone = 0;
+            req->buf = buf;
+            req->status = REQ_PENDING;
+
+            /* The on-board ROM is memory-mapped and never pending */
+            if (type == FLASH_ROM)
+            {
+                if (write)
+                    FATAL("disk_submit: Writing to the read-only ROM");
+                memcpy(buf, (char *)0x20800000 + block_no * BLOCK_SIZE, nblocks * BLOCK_SIZE);
+                req->status = REQ_DONE;
+            }
+            return i;
+        }
+    return -1;
+}
+
+int disk_cancel(int pid)
+{
+    /* A block is transferred within one disk_poll(), so no transfer into
+     * the memory of pid is under way; an open run is simply left open */
+    for (int i = 0; i < NDISK_REQUESTS; i++)
+        if (requests[i].status != REQ_FREE && requests[i].pid == pid)
+            requests[i].status = REQ_FREE;
+    return 0;
+}
+
+int disk_done(int id)
+{
+    if (requests[id].status != REQ_DONE)
+        return 0;
+
+    requests[id].status = REQ_FREE;
+    return 1;
+}
+
+/* The kernel waits for its own requests, which any poll can serve */
+static void disk_kernel(int block_no, int nblocks, char *buf, int write)
+{
+    int id = disk_submit(DISK_KERNEL, block_no, nblocks, buf, write);
+    if (id == -1)
+        FATAL("disk_kernel: no free disk request");
+    while (!disk_done(id))
+        disk_poll(DISK_KERNEL);
+}
+
+int disk_read(int block_no, int nblocks, char *dst)
+{
+    disk_kernel(block_no, nblocks, dst, 0);
     return 0;
 }
 
@@ -39,7 +235,7 @@ int disk_write(int block_no, int nblocks, char *src)
     if (type == FLASH_ROM)
         FATAL("disk_write: Writing to the read-only ROM");
 
-    sdwrite(block_no, nblocks, src);
+    disk_kernel(block_no, nblocks, src, 1);
     return 0;
 }
 
@@ -47,6 +243,10 @@ void disk_init()
 {
     earth->disk_read = disk_read;
     earth->disk_write = disk_write;
+    earth->disk_submit = disk_submit;
+    earth->disk_poll = disk_poll;
+    earth->disk_done = disk_done;
+    earth->disk_cancel = disk_cancel;
 
     CRITICAL("Choose a disk:");
     printf("Enter 0: microSD card\r\nEnter 1: on-board ROM\r\n");
@@ -57,6 +257,9 @@ void disk_init()
     type = (buf[0] == '0') ? SD_CARD : FLASH_ROM;
     INFO("%s is chosen", type == SD_CARD ? "microSD" : "on-board ROM");
 
+    /* The file system grows over the rest of a larger microSD card */
     if (type == SD_CARD)
-        sdinit();
+        earth->disk_nblocks = sdinit();
+    else
+        earth->disk_nblocks = (PAGING_DEV_SIZE + GRASS_EXEC_SIZE + FS_DISK_SIZE) / BLOCK_SIZE;
 }
@@ -4,14 +4,22 @@
 
 char recv_data_byte();
 char send_data_byte(char);
+void sd_transfer(char* tx, char* rx, int len);
 
 char sd_exec_cmd(char*);
 char sd_exec_acmd(char*);
 
-void sdinit();
+unsigned int sdinit();  /* returns the capacity in blocks, 0 if unknown */
 int sdread(int offset, int nblock, char* dst);
 int sdwrite(int offset, int nblock, char* src);
 
+void sd_read_start(int offset);
+void sd_read_block(char* dst);
+void sd_read_stop();
+void sd_write_start(int offset, int nblock);
+void sd_write_block(char* src);
+void sd_write_stop();
+
 /* definitions for controlling SPI1 in FE310
  * see chapter19 of the SiFive FE310-G002 Manual
  */
@@ -27,3 +35,5 @@ int sdwrite(int offset, int nblock, char* src);
 #define SPI1_TXDATA   72UL
 #define SPI1_RXDATA   76UL
 #define SPI1_FCTRL    96UL
+
+#define SPI1_FIFO_DEPTH  8
@@ -9,6 +9,7 @@
  */
 
 #include "sd.h"
+#include "disk.h"
 
 enum {
       SD_TYPE_SD1,
@@ -100,18 +101,99 @@ static void spi_config() {
     REGW(SPI1_BASE, SPI1_FMT) = 0x80000;
 }
 
-static void spi_set_clock(long baud_rate) {
-    long div = (CPU_CLOCK_RATE / (2 * baud_rate)) - 1;
+static long spi_set_clock(long baud_rate) {
+    /* Round the divider up so that the clock never exceeds baud_rate */
+    long div = (CPU_CLOCK_RATE + 2 * baud_rate - 1) / (2 * baud_rate) - 1;
+    if (div < 0) div = 0;
     REGW(SPI1_BASE, SPI1_SCKDIV) = (div & 0xFFF);
+    return CPU_CLOCK_RATE / (2 * (div + 1));
 }
 
-void sdinit() {
+static int sd_read_csd(char* csd) {
+    INFO("Check SD card maximum transfer rate and capacity with cmd9");
+    while (recv_data_byte() != 0xFF);
+
+    char reply, cmd9[] = {0x49, 0x00, 0x00, 0x00, 0x00, 0xFF};
+    if (reply = sd_exec_cmd(cmd9)) FATAL("SD card replies cmd9 with status 0x%.2x", reply);
+
+    /* Wait for the CSD data packet and ignore the 2-byte checksum */
+    int i;
+    for (i = 0; i < 8000 && recv_data_byte() != (char)0xFE; i++);
+    if (i == 8000) return -1;
+    for (int i = 0; i < 16; i++) csd[i] = recv_data_byte();
+    recv_data_byte();
+    recv_data_byte();
+    while (recv_data_byte() != 0xFF);
+    return 0;
+}
+
+static long sd_max_clock(char* csd) {
+    /* TRAN_SPEED is byte 3 of the CSD: a rate unit and a multiplier */
+    static const long units[] = {10000, 100000, 1000000, 10000000};
+    static const long values[] = {0, 10, 12, 13, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 70, 80};
+    int unit = csd[3] & 0x7, value = (csd[3] >> 3) & 0xF;
+    if (unit > 3 || value == 0) return 25000000;
+    return units[unit] * values[value];
+}
+
+static int sd_high_speed() {
+    /* Switch to high-speed mode (function 1 of group 1) with cmd6; the
+     * card then accepts a 50MHz clock instead of 25MHz */
+    INFO("Switch SD card to high-speed mode with cmd6");
+    while (recv_data_byte() != 0xFF);
+
+    char reply, status[64], cmd6[] = {0x46, 0x80, 0xFF, 0xFF, 0xF1, 0xFF};
+    if (reply = sd_exec_cmd(cmd6)) {
+        INFO("SD card replies cmd6 with status 0x%.2x", reply);
+        while (recv_data_byte() != 0xFF);
+        return -1;
+    }
+
+    /* Wait for the 64-byte status packet and ignore the 2-byte checksum */
+    int i;
+    for (i = 0; i < 8000 && recv_data_byte() != (char)0xFE; i++);
+    if (i == 8000) return -1;
+    for (int i = 0; i < 64; i++) status[i] = recv_data_byte();
+    recv_data_byte();
+    recv_data_byte();
+    while (recv_data_byte() != 0xFF);
+
+    /* Bits 379:376 hold the function selected in group 1 */
+    return ((status[16] & 0xF) == 1)? 0 : -1;
+}
+
+static unsigned int sd_capacity(char* csd) {
+    /* A version 2.0 CSD (SDHC/SDXC) holds the capacity in 512KB units in
+     * the 22-bit C_SIZE; block numbers are int, so it is capped at 1TB */
+    if (((unsigned char)csd[0] >> 6) != 1) return 0;
+    unsigned int c_size = ((csd[7] & 0x3F) << 16) | ((csd[8] & 0xFF) << 8) | (csd[9] & 0xFF);
+    if (c_size + 1 >= 0x200000) return 0x7FFFFFFF;
+    return (c_size + 1) * 1024;
+}
+
+static void sd_report_speed() {
+    /* Time a few single-block and multi-block reads in CPU cycles */
+    char buf[BLOCK_SIZE * 4];
+    unsigned int start, single, multi;
+
+    asm volatile("csrr %0, mcycle" : "=r"(start));
+    for (int i = 0; i < 4; i++) sdread(i, 1, buf);
+    asm volatile("csrr %0, mcycle" : "=r"(single));
+    sdread(0, 4, buf);
+    asm volatile("csrr %0, mcycle" : "=r"(multi));
+
+    multi -= single;
+    single -= start;
+    INFO("SD card reads a block in %dus (single) and %dus (multiple)",
+         single / 4 / (CPU_CLOCK_RATE / 1000000), multi / 4 / (CPU_CLOCK_RATE / 1000000));
+}
+
+unsigned int sdinit() {
     spi_set_clock(100000);
     spi_config();
 
     sd_reset();
-    INFO("Set SPI clock frequency to %ldHz", CPU_CLOCK_RATE / 4);
-    spi_set_clock(CPU_CLOCK_RATE / 4);
+    INFO("Set SPI clock frequency to %ldHz", spi_set_clock(CPU_CLOCK_RATE / 4));
 
     INFO("Check SD card type and voltage with cmd8");
     if (0 != sd_check_type()) FATAL("Fail to check SD card type");
@@ -127,4 +209,22 @@ void sdinit() {
 
     if (SD_CARD_TYPE == SD_TYPE_SD2) sd_check_capacity();
     if (SD_CARD_TYPE != SD_TYPE_SDHC) FATAL("Only SDHC/SDXC supported");
+
+    char csd[16];
+    unsigned int nblocks = 0;
+    if (sd_read_csd(csd) == 0) {
+        /* With CPU_CLOCK_RATE at 65MHz, the divider gives 16.25MHz for a
+         * 25MHz card, the same as CPU_CLOCK_RATE / 4 above; only a card
+         * in high-speed mode gets a faster clock (32.5MHz) */
+        long max_clock = sd_max_clock(csd);
+        if (max_clock <= 25000000 && sd_high_speed() == 0) max_clock = 50000000;
+        INFO("Set SPI clock frequency to %ldHz", spi_set_clock(max_clock));
+        nblocks = sd_capacity(csd);
+        INFO("SD card has %d blocks (%dMB)", nblocks, nblocks / 2048);
+    } else {
+        INFO("SD card sends no CSD, assume the default speed");
+        INFO("Set SPI clock frequency to %ldHz", spi_set_clock(25000000));
+    }
+    sd_report_speed();
+    return nblocks;
 }
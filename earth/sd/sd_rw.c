@@ -9,6 +9,7 @@
 
 #include "sd.h"
 #include "disk.h"
+#include <stddef.h>
 
 static void single_read(int offset, char* dst) {
     /* Wait until SD card is not busy */
@@ -23,7 +24,7 @@ static void single_read(int offset, char* dst) {
  
     /* Wait for the data packet and ignore the 2-byte checksum */
     while (recv_data_byte() != 0xFE);
-    for (int i = 0; i < BLOCK_SIZE; i++) dst[i] = recv_data_byte();
+    sd_transfer(NULL, dst, BLOCK_SIZE);
     recv_data_byte();
     recv_data_byte();
 }
@@ -40,7 +41,7 @@ static void single_write(int offset, char* src) {
 
     /* Send data packet: token + block + dummy 2-byte checksum */
     send_data_byte(0xFE);
-    for (int i = 0; i < BLOCK_SIZE; i++) send_data_byte(src[i]);
+    sd_transfer(src, NULL, BLOCK_SIZE);
     send_data_byte(0xFF);
     send_data_byte(0xFF);
 
@@ -50,20 +51,104 @@ static void single_write(int offset, char* src) {
         FATAL("SD card write ack with status 0x%.2x", reply);
 }
 
-int sdread(int offset, int nblock, char* dst) {
-    /* A better way to read multiple blocks using SD card
-     * command 18 is left to students as a course project */
+/* A multi-block read or write is split into start, block and stop steps,
+ * so that dev_disk.c can keep a run open across several requests. */
+void sd_read_start(int offset) {
+    /* Wait until SD card is not busy */
+    while (recv_data_byte() != 0xFF);
+
+    /* Send read request with cmd18 */
+    char *arg = (void*)&offset;
+    char reply, cmd18[] = {0x52, arg[3], arg[2], arg[1], arg[0], 0xFF};
+    if (reply = sd_exec_cmd(cmd18))
+        FATAL("SD card replies cmd18 with status 0x%.2x", reply);
+}
+
+void sd_read_block(char* dst) {
+    /* Wait for the data packet and ignore the 2-byte checksum */
+    while (recv_data_byte() != 0xFE);
+    sd_transfer(NULL, dst, BLOCK_SIZE);
+    recv_data_byte();
+    recv_data_byte();
+}
+
+void sd_read_stop() {
+    /* Stop the transmission with cmd12 */
+    char reply, cmd12[] = {0x4C, 0x00, 0x00, 0x00, 0x00, 0xFF};
+    for (int i = 0; i < 6; i++) send_data_byte(cmd12[i]);
+    recv_data_byte(); /* Skip the stuff byte */
+    while ((reply = recv_data_byte()) & 0x80);
+    if (reply) FATAL("SD card replies cmd12 with status 0x%.2x", reply);
+    while (recv_data_byte() != 0xFF);
+}
 
-    for (int i = 0; i < nblock; i++)
-        single_read(offset + i, dst + BLOCK_SIZE * i);
+void sd_write_start(int offset, int nblock) {
+    /* Tell SD card to pre-erase nblock blocks with acmd23 */
+    char *arg = (void*)&nblock;
+    char reply, acmd23[] = {0x57, arg[3], arg[2], arg[1], arg[0], 0xFF};
+    if (reply = sd_exec_acmd(acmd23))
+        FATAL("SD card replies acmd23 with status 0x%.2x", reply);
+
+    /* Send write request with cmd25 */
+    while (recv_data_byte() != 0xFF);
+    arg = (void*)&offset;
+    char cmd25[] = {0x59, arg[3], arg[2], arg[1], arg[0], 0xFF};
+    if (reply = sd_exec_cmd(cmd25))
+        FATAL("SD card replies cmd25 with status 0x%.2x", reply);
+}
+
+void sd_write_block(char* src) {
+    /* Send data packet: token + block + dummy 2-byte checksum */
+    send_data_byte(0xFC);
+    sd_transfer(src, NULL, BLOCK_SIZE);
+    send_data_byte(0xFF);
+    send_data_byte(0xFF);
+
+    /* Wait for SD card ack of data packet and the end of busy */
+    char reply;
+    while ((reply = recv_data_byte()) == 0xFF);
+    if ((reply & 0x1F) != 0x05)
+        FATAL("SD card write ack with status 0x%.2x", reply);
+    while (recv_data_byte() != 0xFF);
+}
+
+void sd_write_stop() {
+    /* Send the stop token and wait until SD card is not busy */
+    send_data_byte(0xFD);
+    recv_data_byte();
+    while (recv_data_byte() != 0xFF);
+}
+
+static void multi_read(int offset, int nblock, char* dst) {
+    sd_read_start(offset);
+    for (int b = 0; b < nblock; b++) sd_read_block(dst + BLOCK_SIZE * b);
+    sd_read_stop();
+}
+
+static void multi_write(int offset, int nblock, char* src) {
+    sd_write_start(offset, nblock);
+    for (int b = 0; b < nblock; b++) sd_write_block(src + BLOCK_SIZE * b);
+    sd_write_stop();
+}
+
+/* With a model card of zero access and busy time, "make sdmodel" counts
+ * 4192 SPI bytes to read 8 blocks with cmd17 and 4139 with cmd18, 4200
+ * to write them with cmd24 and 4166 with acmd23 + cmd25. The bus time
+ * saved by a multi-block command is thus ~1%; any real speedup comes
+ * from the access and busy time of the card per command, which depends
+ * on the card and has not been measured on one. */
+int sdread(int offset, int nblock, char* dst) {
+    if (nblock == 1)
+        single_read(offset, dst);
+    else
+        multi_read(offset, nblock, dst);
     return 0;
 }
 
 int sdwrite(int offset, int nblock, char* src) {
-    /* A better way to write multiple blocks using SD card
-     * command 25 is left to students as a course project */
-
-    for (int i = 0; i < nblock; i++)
-        single_write(offset + i, src + BLOCK_SIZE * i);
+    if (nblock == 1)
+        single_write(offset, src);
+    else
+        multi_write(offset, nblock, src);
     return 0;
 }
@@ -20,6 +20,26 @@ char send_data_byte(char byte) {
 
 char recv_data_byte() { return send_data_byte(0xFF); }
 
+void sd_transfer(char* tx, char* rx, int len) {
+    /* Send tx (or 0xFF if tx is NULL) and receive into rx (or discard if
+     * rx is NULL); keep up to SPI1_FIFO_DEPTH bytes in flight so that the
+     * TX FIFO stays full and the RX FIFO never overflows */
+    int sent = 0, recvd = 0;
+    while (recvd < len) {
+        while (sent < len && sent - recvd < SPI1_FIFO_DEPTH &&
+               !(REGW(SPI1_BASE, SPI1_TXDATA) & (1 << 31))) {
+            REGB(SPI1_BASE, SPI1_TXDATA) = tx? tx[sent] : 0xFF;
+            sent++;
+        }
+
+        long rxdata;
+        while (recvd < sent && !((rxdata = REGW(SPI1_BASE, SPI1_RXDATA)) & (1 << 31))) {
+            if (rx) rx[recvd] = (char)(rxdata & 0xFF);
+            recvd++;
+        }
+    }
+}
+
 char sd_exec_cmd(char* cmd) {
     for (int i = 0; i < 6; i++) send_data_byte(cmd[i]);
 
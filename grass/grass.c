@@ -18,9 +18,9 @@ struct earth *earth = (void *)GRASS_STACK_TOP;
 
 void kernel_init();
 
-static int sys_proc_read(int block_no, char *dst)
+static int sys_proc_read(int block_no, int nblocks, char *dst)
 {
-    return earth->disk_read(SYS_PROC_EXEC_START + block_no, 1, dst);
+    return earth->disk_read(SYS_PROC_EXEC_START + block_no, nblocks, dst);
 }
 
 int main()
@@ -32,6 +32,7 @@ int main()
     /* Initialize the grass interface functions */
     grass->proc_alloc = proc_alloc;
     grass->proc_free = proc_free;
+    grass->proc_set_heap = proc_set_heap;
     grass->proc_set_ready = proc_set_ready;
 
     grass->sys_exit = sys_exit;
@@ -39,6 +40,9 @@ int main()
     grass->sys_recv = sys_recv;
     grass->sys_tty_read = sys_tty_read;
     grass->sys_tty_write = sys_tty_write;
+    grass->sys_brk = sys_brk;
+    grass->sys_disk_read = sys_disk_read;
+    grass->sys_disk_write = sys_disk_write;
 
     /* Register interrupt and exception handlers */
     earth->intr_register(intr_entry);
@@ -46,8 +50,9 @@ int main()
 
     /* Load the first kernel process GPID_PROCESS */
     INFO("Load kernel process #%d: sys_proc", GPID_PROCESS);
+    proc_alloc();
     elf_load(GPID_PROCESS, sys_proc_read, 0, 0);
-    proc_set_running(proc_alloc());
+    proc_set_running(GPID_PROCESS);
     earth->mmu_switch(GPID_PROCESS);
 
     earth->tty_user_mode();
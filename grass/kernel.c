@@ -54,6 +54,8 @@ struct kernel_msg *KERNEL_MSG_BUFF =
 
 static int proc_tty_read(struct syscall *sc);
 static int proc_tty_write(struct syscall *sc);
+static int proc_brk(struct syscall *sc);
+static int proc_disk(struct syscall *sc, int write);
 static void syscall_handle();
 
 int proc_curr_idx;
@@ -179,13 +181,19 @@ int external_handle()
 
 void proc_wait()
 {
-    int mie;
-    asm("csrr %0, mie" : "=r"(mie));
-    asm("csrw mie, %0" ::"r"(mie & ~(0x88))); // Invert Timer and Software Interrupt Bits
+    /* A disk request only moves while its owner polls it in proc_disk(),
+     * which external_handle() below runs for every requesting process;
+     * so skip wfi while requests are pending, or nothing would wake us */
+    if (earth->disk_poll(-1) == 0)
+    {
+        int mie;
+        asm("csrr %0, mie" : "=r"(mie));
+        asm("csrw mie, %0" ::"r"(mie & ~(0x88))); // Invert Timer and Software Interrupt Bits
 
-    asm("wfi"); // Interrupt Signal Resumes Execution at PC + 4
+        asm("wfi"); // Interrupt Signal Resumes Execution at PC + 4
 
-    asm("csrw mie, %0" ::"r"(mie | 0x88)); // Enable Timer and Software Interrupt Bits
+        asm("csrw mie, %0" ::"r"(mie | 0x88)); // Enable Timer and Software Interrupt Bits
+    }
     external_handle();
 }
 
@@ -289,6 +297,56 @@ static int proc_tty_write(struct syscall *sc)
     return earth->tty_write(msg, len);
 }
 
+static int proc_brk(struct syscall *sc)
+{
+    char *range[2];
+    memcpy(range, sc->msg.content, sizeof(range));
+
+    /* Map the heap pages of curr_pid in [range[0], range[1]) to the zero
+     * frame; the MMU gives a page its own frame when it is first written */
+    struct process *proc = &proc_set[proc_curr_idx];
+    unsigned int page = (unsigned int)range[0] >> 12;
+    unsigned int end = ((unsigned int)range[1] + PAGE_SIZE - 1) >> 12;
+    if (page < proc->heap_start || end < page || end > APPS_ARG >> 12 ||
+        proc->heap_npages + (int)(end - page) > MAX_HEAP_NPAGES)
+        return -2;
+
+    for (; page < end; page++, proc->heap_npages++)
+    {
+        if (earth->mmu_map(curr_pid, page, ZERO_FRAME) < 0)
+            return -2;
+        memset((void *)(page << 12), 0, PAGE_SIZE);
+    }
+    return 0;
+}
+
+static int proc_disk(struct syscall *sc, int write)
+{
+    /* Submit the request and keep requesting until it completes; each
+     * call transfers a few blocks, so other processes run between calls
+     * but the disk is idle while the owner is not in this syscall */
+    struct process *proc = &proc_set[proc_curr_idx];
+    if (proc->disk_req == -1)
+    {
+        int block_no, nblocks;
+        char *buf;
+        memcpy(&block_no, sc->msg.content, sizeof(int));
+        memcpy(&nblocks, sc->msg.content + sizeof(int), sizeof(int));
+        memcpy(&buf, sc->msg.content + 2 * sizeof(int), sizeof(char *));
+
+        proc->disk_req = earth->disk_submit(curr_pid, block_no, nblocks, buf, write);
+        if (proc->disk_req == -1)
+            return -1;
+    }
+
+    earth->disk_poll(curr_pid);
+    if (!earth->disk_done(proc->disk_req))
+        return -1;
+
+    proc->disk_req = -1;
+    return 0;
+}
+
 static void syscall_handle()
 {
     int rc = -1;
@@ -314,6 +372,15 @@ static void syscall_handle()
     case TTY_WRITE:
         rc = proc_tty_write(sc);
         break;
+    case SYS_BRK:
+        rc = proc_brk(sc);
+        break;
+    case DISK_READ:
+        rc = proc_disk(sc, 0);
+        break;
+    case DISK_WRITE:
+        rc = proc_disk(sc, 1);
+        break;
     }
 
     if (rc == 0)
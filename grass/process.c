@@ -19,6 +19,13 @@ static void proc_set_status(int pid, int status)
             proc_set[i].status = status;
 }
 
+void proc_set_heap(int pid, int page_no)
+{
+    for (int i = 0; i < MAX_NPROCESS; i++)
+        if (proc_set[i].pid == pid)
+            proc_set[i].heap_start = page_no;
+}
+
 void proc_set_ready(int pid) { proc_set_status(pid, PROC_READY); }
 void proc_set_running(int pid) { proc_set_status(pid, PROC_RUNNING); }
 void proc_set_runnable(int pid) { proc_set_status(pid, PROC_RUNNABLE); }
@@ -34,6 +41,9 @@ int proc_alloc()
             proc_set[i].pid = ++proc_nprocs;
             proc_set[i].status = PROC_LOADING;
             proc_set[i].killable = proc_set[i].pid >= GPID_USER_START;
+            proc_set[i].heap_start = APPS_ARG >> 12;
+            proc_set[i].heap_npages = 0;
+            proc_set[i].disk_req = -1;
             return proc_nprocs;
         }
 
@@ -42,19 +52,14 @@ int proc_alloc()
 
 void proc_free(int pid)
 {
-    if (pid != -1)
-    {
-        earth->mmu_free(pid);
-        proc_set_status(pid, PROC_UNUSED);
-        return;
-    }
-
-    /* Free all user applications */
+    /* Free pid or, if pid is -1, all user applications */
     for (int i = 0; i < MAX_NPROCESS; i++)
-        if (proc_set[i].pid >= GPID_USER_START &&
-            proc_set[i].status != PROC_UNUSED)
+        if (proc_set[i].status != PROC_UNUSED &&
+            (pid == -1 ? proc_set[i].pid >= GPID_USER_START : proc_set[i].pid == pid))
         {
             earth->mmu_free(proc_set[i].pid);
+            earth->disk_cancel(proc_set[i].pid);
+            proc_set[i].disk_req = -1;
             proc_set[i].status = PROC_UNUSED;
         }
 }
@@ -21,11 +21,13 @@ struct process
     int pid;
     int status;
     int killable;
+    int heap_start;  /* first page after the ELF image, see proc_brk() */
+    int heap_npages; /* heap pages mapped by proc_brk() */
+    int disk_req;    /* pending disk request, see proc_disk() */
     void *sp, *mepc; /* process context = stack pointer (sp)
                       * + machine exception program counter (mepc) */
 };
 
-#define MAX_NPROCESS 16
 extern int proc_curr_idx;
 extern struct process proc_set[MAX_NPROCESS];
 #define curr_pid proc_set[proc_curr_idx].pid
@@ -36,6 +38,7 @@ void excp_entry(int);
 
 int proc_alloc();
 void proc_free(int);
+void proc_set_heap(int, int);
 void proc_set_ready(int);
 void proc_set_running(int);
 void proc_set_runnable(int);
@@ -62,9 +62,38 @@ int sys_tty_write(char *msg, int len)
     return sc->retval;
 }
 
+int sys_brk(char *start, char *end)
+{
+    char *range[2] = {start, end};
+    sc->type = SYS_BRK;
+    memcpy(sc->msg.content, range, sizeof(range));
+    sys_invoke();
+    return sc->retval;
+}
+
 void sys_exit(int status)
 {
     struct proc_request req;
     req.type = PROC_EXIT;
     sys_send(GPID_PROCESS, (void *)&req, sizeof(req));
 }
+
+static int sys_disk(int type, int block_no, int nblocks, char *buf)
+{
+    sc->type = type;
+    memcpy(sc->msg.content, &block_no, sizeof(int));
+    memcpy(sc->msg.content + sizeof(int), &nblocks, sizeof(int));
+    memcpy(sc->msg.content + 2 * sizeof(int), &buf, sizeof(char *));
+    sys_invoke();
+    return sc->retval;
+}
+
+int sys_disk_read(int block_no, int nblocks, char *dst)
+{
+    return sys_disk(DISK_READ, block_no, nblocks, dst);
+}
+
+int sys_disk_write(int block_no, int nblocks, char *src)
+{
+    return sys_disk(DISK_WRITE, block_no, nblocks, src);
+}
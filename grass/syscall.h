@@ -11,6 +11,9 @@ enum syscall_type
     SYS_SEND,
     TTY_READ,
     TTY_WRITE,
+    SYS_BRK,
+    DISK_READ,
+    DISK_WRITE,
     SYS_NCALLS
 };
 
@@ -33,3 +36,6 @@ int sys_send(int pid, char *msg, int size);
 int sys_recv(int *pid, char *buf, int size);
 int sys_tty_read(char *c);
 int sys_tty_write(char *msg, int len);
+int sys_brk(char *start, char *end);
+int sys_disk_read(int block_no, int nblocks, char *dst);
+int sys_disk_write(int block_no, int nblocks, char *src);
@@ -17,6 +17,10 @@ struct earth
     /* Devices interface */
     int (*disk_read)(int block_no, int nblocks, char *dst);
     int (*disk_write)(int block_no, int nblocks, char *src);
+    int (*disk_submit)(int pid, int block_no, int nblocks, char *buf, int write);
+    int (*disk_poll)(int pid);
+    int (*disk_done)(int id);
+    int (*disk_cancel)(int pid);
 
     int (*tty_read)(char *c);
     int (*tty_write)(char *msg, int len);
@@ -45,6 +49,9 @@ struct earth
         PAGE_TABLE,
         SOFT_TLB
     } translation;
+
+    /* Capacity of the disk in blocks, 0 if unknown */
+    unsigned int disk_nblocks;
 };
 
 struct grass
@@ -56,6 +63,7 @@ struct grass
     /* Process control interface */
     int (*proc_alloc)();
     void (*proc_free)(int pid);
+    void (*proc_set_heap)(int pid, int page_no);
     void (*proc_set_ready)(int pid);
 
     /* System call interface */
@@ -64,6 +72,9 @@ struct grass
     int (*sys_recv)(int *pid, char *buf, int size);
     int (*sys_tty_read)(char *c);
     int (*sys_tty_write)(char *msg, int len);
+    int (*sys_brk)(char *start, char *end);
+    int (*sys_disk_read)(int block_no, int nblocks, char *dst);
+    int (*sys_disk_write)(int block_no, int nblocks, char *src);
 };
 
 extern struct earth *earth;
@@ -76,6 +87,7 @@ extern struct grass *grass;
 
 /* Memory layout */
 #define PAGE_SIZE 4096
+#define LIBC_ENTRY 0x209A0000        /* 128KB  shared libc in ROM    */
 #define FRAME_CACHE_END 0x80020000
 #define FRAME_CACHE_START 0x80004000 /* 112KB  frame cache           */
                                      /*        earth interface       */
@@ -87,11 +99,21 @@ extern struct grass *grass;
 #define APPS_ARG 0x80000000       /* 1KB    app main() argc, argv */
 #define APPS_SIZE 0x00003000
 #define APPS_ENTRY 0x08005000 /* 12KB   app code+data         */
+#ifndef APPS_MAX_SIZE
+#define APPS_MAX_SIZE 0x00040000 /* app code+data on QEMU whose ITIM is 32MB */
+#endif
 #define GRASS_SIZE 0x00002800
 #define GRASS_ENTRY 0x08002800 /* 8KB    grass code+data       */
                                /* 12KB   earth data            */
                                /* earth code is in QSPI flash  */
 
+/* mmu_map() a page to ZERO_FRAME to share the all-zero frame */
+#define ZERO_FRAME -1
+
+/* Limits of the grass processes, which also size the earth MMU tables */
+#define MAX_NPROCESS 16
+#define MAX_HEAP_NPAGES 64 /* heap pages of a process beyond its ELF image */
+
 #define DEV_BUFF_SIZE 128
 
 #ifndef LIBC_STDIO
@@ -5,7 +5,7 @@
 
 /* Author: Yunhao Zhang
  * Description: load an ELF-format executable file into memory
- * Only use the program header instead of the multiple section headers.
+ * Only use the program headers instead of the multiple section headers.
  */
 
 #include "egos.h"
@@ -22,54 +22,91 @@ static void load_grass(elf_reader reader,
     INFO("Grass kernel memory size: 0x%.8x bytes", pheader->p_memsz);
 
     char *entry = (char *)GRASS_ENTRY;
-    int block_offset = pheader->p_offset / BLOCK_SIZE;
-    for (int off = 0; off < pheader->p_filesz; off += BLOCK_SIZE)
-        reader(block_offset++, entry + off);
+    int nblocks = (pheader->p_filesz + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    reader(pheader->p_offset / BLOCK_SIZE, nblocks, entry);
 
     memset(entry + pheader->p_filesz, 0, GRASS_SIZE - pheader->p_filesz);
 }
 
+static void load_zero_page(int pid, int page_no)
+{
+    if (earth->mmu_map(pid, page_no, ZERO_FRAME) < 0)
+        FATAL("elf_load: no frame left for bss page 0x%x", page_no);
+}
+
 static void load_app(int pid, elf_reader reader,
-                     int argc, void **argv,
+                     int argc, void **argv, int phnum,
                      struct elf32_program_header *pheader)
 {
-
-    /* Debug printing during bootup */
-    if (pid < GPID_USER_START)
+    char block[BLOCK_SIZE], *base;
+    int frame_no, block_no = -1;
+    unsigned int curr_page = 0, next_page = APPS_ENTRY >> 12, stack_start = APPS_ARG >> 12;
+    unsigned int image_end = APPS_ENTRY;
+    unsigned int apps_end = APPS_ENTRY + (earth->platform == ARTY ? APPS_SIZE : APPS_MAX_SIZE);
+
+    /* Setup the text, rodata, data and bss sections of every segment */
+    for (int i = 0; i < phnum; i++)
     {
-        INFO("App file size: 0x%.8x bytes", pheader->p_filesz);
-        INFO("App memory size: 0x%.8x bytes", pheader->p_memsz);
-    }
+        struct elf32_program_header *seg = &pheader[i];
+        if (seg->p_type != PT_LOAD || seg->p_memsz == 0)
+            continue;
+        if (seg->p_vaddr < image_end || seg->p_vaddr + seg->p_memsz > apps_end)
+            FATAL("elf_load: Invalid segment at 0x%.8x", seg->p_vaddr);
 
-    void *base;
-    int frame_no, block_offset = pheader->p_offset / BLOCK_SIZE;
-    unsigned int code_start = APPS_ENTRY >> 12, stack_start = APPS_ARG >> 12;
+        /* Debug printing during bootup */
+        if (pid < GPID_USER_START)
+            INFO("App segment 0x%.8x: file size 0x%.8x, memory size 0x%.8x bytes",
+                 seg->p_vaddr, seg->p_filesz, seg->p_memsz);
 
-    /* Setup the text, rodata, data and bss sections */
-    for (int off = 0; off < pheader->p_filesz; off += BLOCK_SIZE)
-    {
-        if (off % PAGE_SIZE == 0)
+        for (unsigned int off = 0; off < seg->p_filesz;)
         {
-            earth->mmu_alloc(&frame_no, &base);
-            earth->mmu_map(pid, code_start++, frame_no);
+            unsigned int vaddr = seg->p_vaddr + off, file_off = seg->p_offset + off;
+            if ((vaddr >> 12) != curr_page)
+            {
+                /* Pages between two segments only hold bss */
+                curr_page = vaddr >> 12;
+                while (next_page < curr_page)
+                    load_zero_page(pid, next_page++);
+
+                earth->mmu_alloc(&frame_no, (void **)&base);
+                earth->mmu_map(pid, next_page++, frame_no);
+                memset(base, 0, PAGE_SIZE);
+            }
+
+            /* Copy until the end of this block, page or segment */
+            int len = BLOCK_SIZE - file_off % BLOCK_SIZE;
+            if (len > PAGE_SIZE - vaddr % PAGE_SIZE)
+                len = PAGE_SIZE - vaddr % PAGE_SIZE;
+            if (len > seg->p_filesz - off)
+                len = seg->p_filesz - off;
+
+            if (len == BLOCK_SIZE)
+            {
+                /* Read all the whole blocks in this page with one request */
+                unsigned int left = PAGE_SIZE - vaddr % PAGE_SIZE;
+                if (left > seg->p_filesz - off)
+                    left = seg->p_filesz - off;
+                len = left / BLOCK_SIZE * BLOCK_SIZE;
+                reader(file_off / BLOCK_SIZE, len / BLOCK_SIZE, base + vaddr % PAGE_SIZE);
+            }
+            else
+            {
+                if (block_no != file_off / BLOCK_SIZE)
+                    reader(block_no = file_off / BLOCK_SIZE, 1, block);
+                memcpy(base + vaddr % PAGE_SIZE, block + file_off % BLOCK_SIZE, len);
+            }
+            off += len;
         }
-        reader(block_offset++, (char *)base + (off % PAGE_SIZE));
+        image_end = seg->p_vaddr + seg->p_memsz;
     }
 
-    int last_page_filled = pheader->p_filesz % PAGE_SIZE;
-    int last_page_nzeros = PAGE_SIZE - last_page_filled;
-    if (last_page_filled)
-        memset((char *)base + last_page_filled, 0, last_page_nzeros);
-
-    while (code_start < ((APPS_ENTRY + APPS_SIZE) >> 12))
-    {
-        earth->mmu_alloc(&frame_no, &base);
-        earth->mmu_map(pid, code_start++, frame_no);
-        memset((char *)base, 0, PAGE_SIZE);
-    }
+    /* The bss pages get a private frame only once written */
+    while (next_page < (image_end + PAGE_SIZE - 1) >> 12)
+        load_zero_page(pid, next_page++);
+    grass->proc_set_heap(pid, next_page);
 
     /* Setup two pages for argc, argv and stack */
-    earth->mmu_alloc(&frame_no, &base);
+    earth->mmu_alloc(&frame_no, (void **)&base);
     earth->mmu_map(pid, stack_start++, frame_no);
 
     int *argc_addr = (int *)base;
@@ -82,27 +119,21 @@ static void load_app(int pid, elf_reader reader,
     for (int i = 0; i < argc; i++)
         argv_addr[i] = APPS_ARG + 4 + 4 * CMD_NARGS + i * CMD_ARG_LEN;
 
-    earth->mmu_alloc(&frame_no, &base);
+    earth->mmu_alloc(&frame_no, (void **)&base);
     earth->mmu_map(pid, stack_start++, frame_no);
 }
 
 void elf_load(int pid, elf_reader reader, int argc, void **argv)
 {
     char buf[BLOCK_SIZE];
-    reader(0, buf);
+    reader(0, 1, buf);
 
     struct elf32_header *header = (void *)buf;
     struct elf32_program_header *pheader = (void *)(buf + header->e_phoff);
 
     for (int i = 0; i < header->e_phnum; i++)
-    {
-        if (pheader[i].p_memsz == 0)
-            continue;
-        else if (pheader[i].p_vaddr == GRASS_ENTRY)
-            load_grass(reader, &pheader[i]);
-        else if (pheader[i].p_vaddr == APPS_ENTRY)
-            load_app(pid, reader, argc, argv, &pheader[i]);
-        else
-            FATAL("elf_load: Invalid p_vaddr: 0x%.8x", pheader->p_vaddr);
-    }
+        if (pheader[i].p_memsz && pheader[i].p_vaddr == GRASS_ENTRY)
+            return load_grass(reader, &pheader[i]);
+
+    load_app(pid, reader, argc, argv, header->e_phnum, pheader);
 }
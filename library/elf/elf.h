@@ -20,6 +20,8 @@ struct elf32_header {
     uint16_t       e_shstrndx;
 };
 
+#define PT_LOAD    1
+
 struct elf32_program_header {
     uint32_t       p_type;
     uint32_t       p_offset;
@@ -31,5 +33,6 @@ struct elf32_program_header {
     uint32_t       p_align;
 };
 
-typedef int (*elf_reader)(int block_no, char* dst);
+/* An elf_reader reads nblocks consecutive blocks from block_no on into dst */
+typedef int (*elf_reader)(int block_no, int nblocks, char* dst);
 void elf_load(int pid, elf_reader reader, int argc, void** argv);
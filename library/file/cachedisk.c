@@ -0,0 +1,209 @@
+/* Description: a write-back block cache as an inode_store layer
+ * A cachedisk keeps the most recently used blocks of the inode store
+ * below, e.g., the superblock, inode blocks and directories of a
+ * treedisk, and is stacked as treedisk_init(cachedisk_init(below, n), 0).
+ * A write only updates the cache and marks the block dirty; a dirty block
+ * is written to the layer below when it is evicted or flushed by
+ * cachedisk_flush(). The least recently used block is evicted first.
+ * Stacked on top of a treedisk, a cachedisk also caches file writes: a
+ * dirty block beyond the end of a file makes the file larger, and the
+ * blocks before it that are not in the layer below yet read as holes.
+ */
+
+#include "egos.h"
+#include "inode.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct cache_entry {
+    int valid, dirty;
+    unsigned int ino;               /* inode number in the layer below */
+    block_no offset;                /* block number in this inode */
+    unsigned int last_use;          /* for choosing the LRU block */
+    block_t block;
+};
+
+struct cachedisk_state {
+    inode_store_t *below;           /* inode store below */
+    int nblocks;                    /* number of blocks in the cache */
+    unsigned int clock;             /* incremented at every access */
+    struct cache_entry *entries;
+    struct cachedisk_stats stats;
+};
+
+static struct cache_entry *cache_lookup(struct cachedisk_state *cs, unsigned int ino, block_no offset) {
+    for (int i = 0; i < cs->nblocks; i++) {
+        struct cache_entry *entry = &cs->entries[i];
+        if (entry->valid && entry->ino == ino && entry->offset == offset)
+            return entry;
+    }
+    return NULL;
+}
+
+static int cache_writeback(struct cachedisk_state *cs, struct cache_entry *entry) {
+    if (!entry->valid || !entry->dirty) return 0;
+
+    /* A block that cannot be written back stays dirty */
+    cs->stats.writebacks++;
+    if ((*cs->below->write)(cs->below, entry->ino, entry->offset, &entry->block) < 0)
+        return -1;
+    entry->dirty = 0;
+    return 0;
+}
+
+/* Find an invalid entry or evict the least recently used one.
+ */
+static struct cache_entry *cache_victim(struct cachedisk_state *cs) {
+    struct cache_entry *victim = &cs->entries[0];
+    for (int i = 0; i < cs->nblocks; i++) {
+        struct cache_entry *entry = &cs->entries[i];
+        if (!entry->valid) return entry;
+        if (entry->last_use < victim->last_use) victim = entry;
+    }
+
+    cs->stats.evictions++;
+    if (cache_writeback(cs, victim) < 0) return NULL;
+    victim->valid = 0;
+    return victim;
+}
+
+static int cachedisk_getsize(inode_store_t *this_bs, unsigned int ino) {
+    struct cachedisk_state *cs = this_bs->state;
+    int size = (*cs->below->getsize)(cs->below, ino);
+    if (size < 0) return size;
+
+    for (int i = 0; i < cs->nblocks; i++) {
+        struct cache_entry *entry = &cs->entries[i];
+        if (entry->valid && entry->dirty && entry->ino == ino && entry->offset >= size)
+            size = entry->offset + 1;
+    }
+    return size;
+}
+
+static int cachedisk_setsize(inode_store_t *this_bs, unsigned int ino, block_no newsize) {
+    struct cachedisk_state *cs = this_bs->state;
+
+    /* Drop the cached blocks beyond the new size */
+    for (int i = 0; i < cs->nblocks; i++) {
+        struct cache_entry *entry = &cs->entries[i];
+        if (entry->valid && entry->ino == ino && entry->offset >= newsize)
+            entry->valid = 0;
+    }
+    return (*cs->below->setsize)(cs->below, ino, newsize);
+}
+
+static int cachedisk_read(inode_store_t *this_bs, unsigned int ino, block_no offset, block_t *block) {
+    struct cachedisk_state *cs = this_bs->state;
+    struct cache_entry *entry = cache_lookup(cs, ino, offset);
+
+    if (entry) {
+        cs->stats.hits++;
+    } else {
+        cs->stats.misses++;
+        if ((entry = cache_victim(cs)) == NULL) return -1;
+        if ((*cs->below->read)(cs->below, ino, offset, &entry->block) < 0) {
+            if (offset >= cachedisk_getsize(this_bs, ino)) return -1;
+            memset(&entry->block, 0, BLOCK_SIZE);
+        }
+        entry->valid = 1;
+        entry->dirty = 0;
+        entry->ino = ino;
+        entry->offset = offset;
+    }
+
+    entry->last_use = ++cs->clock;
+    memcpy(block, &entry->block, BLOCK_SIZE);
+    return 0;
+}
+
+/* A run of blocks that are not cached is read from below in one request.
+ * These blocks bypass the cache, so that streaming through a large file
+ * does not evict the hot blocks such as inode blocks and directories.
+ */
+static int cachedisk_readv(inode_store_t *this_bs, unsigned int ino, block_no offset, block_t *blocks, block_no nblocks) {
+    struct cachedisk_state *cs = this_bs->state;
+
+    for (block_no i = 0; i < nblocks; ) {
+        if (cache_lookup(cs, ino, offset + i)) {
+            cachedisk_read(this_bs, ino, offset + i, &blocks[i]);
+            i++;
+            continue;
+        }
+
+        block_no n = 1;
+        while (i + n < nblocks && !cache_lookup(cs, ino, offset + i + n)) n++;
+        cs->stats.misses += n;
+        if ((*cs->below->readv)(cs->below, ino, offset + i, &blocks[i], n) < 0) {
+            /* Part of the run is beyond the end of the file below */
+            for (block_no j = 0; j < n; j++)
+                if (cachedisk_read(this_bs, ino, offset + i + j, &blocks[i + j]) < 0) return -1;
+        }
+        i += n;
+    }
+    return 0;
+}
+
+static int cachedisk_write(inode_store_t *this_bs, unsigned int ino, block_no offset, block_t *block) {
+    struct cachedisk_state *cs = this_bs->state;
+    struct cache_entry *entry = cache_lookup(cs, ino, offset);
+
+    if (entry) {
+        cs->stats.hits++;
+    } else {
+        /* The whole block is overwritten, so no need to read it */
+        cs->stats.misses++;
+        if ((entry = cache_victim(cs)) == NULL) return -1;
+        entry->valid = 1;
+        entry->ino = ino;
+        entry->offset = offset;
+    }
+
+    entry->dirty = 1;
+    entry->last_use = ++cs->clock;
+    memcpy(&entry->block, block, BLOCK_SIZE);
+    return 0;
+}
+
+/* Write the dirty blocks back in order of inode and offset, so that the
+ * layer below sees the blocks of a file, e.g., appended ones, in order.
+ */
+int cachedisk_flush(inode_store_t *this_bs) {
+    struct cachedisk_state *cs = this_bs->state;
+    for (;;) {
+        struct cache_entry *first = NULL;
+        for (int i = 0; i < cs->nblocks; i++) {
+            struct cache_entry *entry = &cs->entries[i];
+            if (entry->valid && entry->dirty && (first == NULL || entry->ino < first->ino ||
+                (entry->ino == first->ino && entry->offset < first->offset)))
+                first = entry;
+        }
+        if (first == NULL) return 0;
+        if (cache_writeback(cs, first) < 0) return -1;
+    }
+}
+
+void cachedisk_stats(inode_store_t *this_bs, struct cachedisk_stats *stats) {
+    struct cachedisk_state *cs = this_bs->state;
+    memcpy(stats, &cs->stats, sizeof(*stats));
+}
+
+inode_store_t *cachedisk_init(inode_store_t *below, int nblocks) {
+    struct cachedisk_state *cs = malloc(sizeof(struct cachedisk_state));
+    memset(cs, 0, sizeof(struct cachedisk_state));
+    cs->below = below;
+
+    cs->nblocks = nblocks;
+    cs->entries = malloc(cs->nblocks * sizeof(struct cache_entry));
+    memset(cs->entries, 0, cs->nblocks * sizeof(struct cache_entry));
+
+    inode_store_t *this_bs = malloc(sizeof(inode_store_t));
+    memset(this_bs, 0, sizeof(inode_store_t));
+    this_bs->state = cs;
+    this_bs->getsize = cachedisk_getsize;
+    this_bs->setsize = cachedisk_setsize;
+    this_bs->read = cachedisk_read;
+    this_bs->write = cachedisk_write;
+    this_bs->readv = cachedisk_readv;
+    this_bs->sync = cachedisk_flush;
+    return this_bs;
+}
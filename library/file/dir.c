@@ -0,0 +1,162 @@
+/* Description: directories in the layout of dir.h
+ * The file server resolves names and paths with these functions directly
+ * on its inode store, and mkfs uses the hash functions to make directories.
+ */
+
+#include "dir.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* FNV-1a hash over the first DIRENT_NAME_LEN characters of name */
+unsigned int dir_hash(char* name) {
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < DIRENT_NAME_LEN && name[i]; i++)
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    return hash;
+}
+
+/* Number of blocks for nentries entries, keeping the table at most 3/4 full */
+int dir_nblocks(int nentries) {
+    int nslots = nentries + 1 + nentries / 3;
+    return (nslots + DIRENTS_PER_BLOCK - 1) / DIRENTS_PER_BLOCK;
+}
+
+/* Return the slot of name in block block_no of a directory, or -1 if the
+ * block does not have it; *full is set if the block has no free slot.
+ */
+int dir_block_find(union dir_block* dir, int block_no, char* name, int* full) {
+    *full = 0;
+    if (strlen(name) > DIRENT_NAME_LEN) return -1;
+
+    for (int i = DIR_FIRST_SLOT(block_no); i < DIRENTS_PER_BLOCK; i++) {
+        if (dir->entries[i].name[0] == 0) return -1;
+        if (!strncmp(dir->entries[i].name, name, DIRENT_NAME_LEN)) return i;
+    }
+    *full = 1;
+    return -1;
+}
+
+/* Look up name in directory dir_ino of inode store fs, reading the header
+ * in block 0 and then, usually, only the block the name hashes to.
+ */
+int dir_find(inode_intf fs, int dir_ino, char* name) {
+    union dir_block dir;
+    if (fs->read(fs, dir_ino, 0, (void*)&dir) < 0 || dir.header.magic != DIR_MAGIC)
+        return -1;
+
+    int nblocks = dir.header.nblocks, curr = 0, full, slot;
+    int home = dir_hash(name) % nblocks;
+    for (int i = 0; i < nblocks; i++) {
+        int b = (home + i) % nblocks;
+        if (b != curr && fs->read(fs, dir_ino, curr = b, (void*)&dir) < 0) return -1;
+        if ((slot = dir_block_find(&dir, b, name, &full)) >= 0) return dir.entries[slot].ino;
+        if (!full) return -1;
+    }
+    return -1;
+}
+
+/* Copy the entries in block block_no of a directory to entries[] and
+ * return their number, or -1 beyond the last block.
+ */
+int dir_list(inode_intf fs, int dir_ino, int block_no, struct dir_entry* entries) {
+    union dir_block dir;
+    if (fs->read(fs, dir_ino, 0, (void*)&dir) < 0 || dir.header.magic != DIR_MAGIC ||
+        block_no >= dir.header.nblocks)
+        return -1;
+    if (block_no > 0 && fs->read(fs, dir_ino, block_no, (void*)&dir) < 0)
+        return -1;
+
+    int n = 0;
+    for (int i = DIR_FIRST_SLOT(block_no); i < DIRENTS_PER_BLOCK && dir.entries[i].name[0]; i++)
+        memcpy(&entries[n++], &dir.entries[i], sizeof(struct dir_entry));
+    return n;
+}
+
+/* A cache of recent lookups, keyed by (parent ino, name).  A negative
+ * entry (ino == -1) remembers that the name is not in the directory.
+ * Inserting or removing a name must call dcache_invalidate() for it.
+ */
+struct dentry {
+    int valid, parent, ino;
+    unsigned int last_use;
+    char name[DIRENT_NAME_LEN + 2];
+};
+static struct dentry* dcache;
+static int dcache_nentries;
+static unsigned int dcache_clock;
+
+void dcache_init(int nentries) {
+    dcache_nentries = nentries;
+    dcache = malloc(nentries * sizeof(struct dentry));
+    memset(dcache, 0, nentries * sizeof(struct dentry));
+}
+
+static struct dentry* dcache_find(int parent, char* name) {
+    for (int i = 0; i < dcache_nentries; i++)
+        if (dcache[i].valid && dcache[i].parent == parent &&
+            !strncmp(dcache[i].name, name, DIRENT_NAME_LEN + 1))
+            return &dcache[i];
+    return NULL;
+}
+
+/* Without a name, forget all the names looked up in directory parent */
+void dcache_invalidate(int parent, char* name) {
+    if (name == NULL) {
+        for (int i = 0; i < dcache_nentries; i++)
+            if (dcache[i].parent == parent) dcache[i].valid = 0;
+        return;
+    }
+
+    struct dentry* d = dcache_find(parent, name);
+    if (d) d->valid = 0;
+}
+
+/* dir_find() through the cache */
+int dir_resolve(inode_intf fs, int dir_ino, char* name) {
+    if (strlen(name) > DIRENT_NAME_LEN) return -1;
+    if (dcache_nentries == 0) return dir_find(fs, dir_ino, name);
+
+    struct dentry* d = dcache_find(dir_ino, name);
+    if (d == NULL) {
+        d = &dcache[0];
+        for (int i = 0; i < dcache_nentries; i++) {
+            if (!dcache[i].valid) { d = &dcache[i]; break; }
+            if (dcache[i].last_use < d->last_use) d = &dcache[i];
+        }
+
+        d->ino = dir_find(fs, dir_ino, name);
+        d->valid = 1;
+        d->parent = dir_ino;
+        strcpy(d->name, name);
+    }
+
+    d->last_use = ++dcache_clock;
+    return d->ino;
+}
+
+/* Resolve a path one name at a time from dir_ino, or from the root if the
+ * path starts with '/'.  A name followed by '/' is looked up with the '/',
+ * as directory names are stored by mkfs.
+ */
+int dir_resolve_path(inode_intf fs, int dir_ino, char* path) {
+    char name[DIRENT_NAME_LEN + 2];
+    if (*path == '/') {
+        dir_ino = 0;
+        while (*path == '/') path++;
+    }
+
+    while (*path && dir_ino >= 0) {
+        int len = 0;
+        while (path[len] && path[len] != '/') len++;
+        if (len > DIRENT_NAME_LEN) return -1;
+
+        memcpy(name, path, len);
+        if (path[len] == '/') name[len++] = '/';
+        name[len] = 0;
+        dir_ino = dir_resolve(fs, dir_ino, name);
+
+        path += len;
+        while (*path == '/') path++;
+    }
+    return dir_ino;
+}
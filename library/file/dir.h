@@ -0,0 +1,51 @@
+/* Description: the layout of a directory
+ * A directory is a file of nblocks blocks holding fixed-size entries and
+ * used as a hash table: an entry is stored in block dir_hash(name) % nblocks
+ * or, if this block is full, in the next block that is not full (wrapping
+ * around).  The entries of a block are packed from its first slot, so a
+ * lookup stops at the first block that has a free slot.  The first slot of
+ * block 0 holds the directory header instead of an entry.
+ */
+#pragma once
+#include "inode.h"
+
+#define DIR_MAGIC           0x44495230   /* "DIR0" */
+#define DIRENT_NAME_LEN     32
+#define DIRENTS_PER_BLOCK   (BLOCK_SIZE / sizeof(struct dir_entry))
+#define DIR_FIRST_SLOT(b)   ((b) == 0 ? 1 : 0)
+
+/* A name shorter than DIRENT_NAME_LEN is null terminated; a free entry
+ * has an empty name.
+ */
+struct dir_entry {
+    unsigned short ino;
+    char name[DIRENT_NAME_LEN];
+};
+
+struct dir_header {
+    unsigned int magic;       /* DIR_MAGIC */
+    unsigned int nblocks;     /* # blocks of the directory */
+    unsigned int nentries;    /* # entries in the directory */
+    unsigned int unused;
+};
+
+union dir_block {
+    block_t block;
+    struct dir_header header;
+    struct dir_entry entries[DIRENTS_PER_BLOCK];
+};
+
+unsigned int dir_hash(char* name);
+int dir_nblocks(int nentries);
+int dir_block_find(union dir_block* dir, int block_no, char* name, int* full);
+
+/* Directory resolution on an inode store, used by the file server */
+#define DCACHE_NENTRIES       32
+#define DCACHE_NENTRIES_ARTY  8
+
+void dcache_init(int nentries);
+void dcache_invalidate(int parent, char* name);
+int dir_find(inode_intf fs, int dir_ino, char* name);
+int dir_resolve(inode_intf fs, int dir_ino, char* name);
+int dir_resolve_path(inode_intf fs, int dir_ino, char* path);
+int dir_list(inode_intf fs, int dir_ino, int block_no, struct dir_entry* entries);
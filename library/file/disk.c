@@ -5,22 +5,33 @@
 
 /* Author: Yunhao Zhang
  * Description: the inode_store structure for accessing the physical disk
+ * The file system takes the rest of the disk after the paging area and
+ * the exec slots, i.e., FS_DISK_SIZE on the disk image and more on a
+ * larger microSD card.
  */
 
 #include "egos.h"
 #include "disk.h"
 #include "inode.h"
 
-static int disk_getsize() { return FS_DISK_SIZE / BLOCK_SIZE; }
+static int disk_getsize() {
+    unsigned int nblocks = earth->disk_nblocks;
+    if (nblocks < GRASS_FS_START + FS_DISK_SIZE / BLOCK_SIZE) return FS_DISK_SIZE / BLOCK_SIZE;
+    return nblocks - GRASS_FS_START;
+}
 
 static int disk_setsize() { FATAL("disk: cannot set the size"); }
 
 static int disk_read(inode_intf bs, unsigned int ino, block_no offset, block_t *block) {
-    return earth->disk_read(GRASS_FS_START + offset, 1, block->bytes);
+    return grass->sys_disk_read(GRASS_FS_START + offset, 1, block->bytes);
+}
+
+static int disk_readv(inode_intf bs, unsigned int ino, block_no offset, block_t *blocks, block_no nblocks) {
+    return grass->sys_disk_read(GRASS_FS_START + offset, nblocks, blocks->bytes);
 }
 
 static int disk_write(inode_intf bs, unsigned int ino, block_no offset, block_t *block) {
-    return earth->disk_write(GRASS_FS_START + offset, 1, block->bytes);
+    return grass->sys_disk_write(GRASS_FS_START + offset, 1, block->bytes);
 }
 
 static inode_store_t disk;
@@ -28,6 +39,7 @@ static inode_store_t disk;
 inode_intf fs_disk_init() {
     disk.read = disk_read;
     disk.write = disk_write;
+    disk.readv = disk_readv;
     disk.getsize = disk_getsize;
     disk.setsize = disk_setsize;
 
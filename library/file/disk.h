@@ -12,6 +12,7 @@
 #define SYS_FILE_EXEC_START   GRASS_EXEC_START + GRASS_EXEC_SEGMENT * 2
 #define SYS_DIR_EXEC_START    GRASS_EXEC_START + GRASS_EXEC_SEGMENT * 3
 #define SYS_SHELL_EXEC_START  GRASS_EXEC_START + GRASS_EXEC_SEGMENT * 4
+#define LIBC_EXEC_START       GRASS_EXEC_START + GRASS_EXEC_SEGMENT * 5
 
 #define GRASS_FS_START        (PAGING_DEV_SIZE + GRASS_EXEC_SIZE) / BLOCK_SIZE
 
@@ -0,0 +1,401 @@
+/* Description: an extent-based inode store
+ * An extentdisk implements the same interface as a treedisk (see file.c):
+ *
+ *      int extentdisk_create(inode_store_t *below, unsigned int below_ino, unsigned int ninodes,
+ *                            unsigned int block_size)
+ *          creates an extentdisk file system within inode below_ino of below,
+ *          which allocates space in FS blocks of block_size bytes
+ *
+ *      inode_store_t *extentdisk_init(inode_store_t *below, unsigned int below_ino)
+ *          opens the extentdisk within inode below_ino of below, or returns
+ *          NULL if there is no extentdisk (e.g., it is a treedisk); like a
+ *          treedisk, it grows to the size of inode below_ino
+ *
+ * A file is mapped by a list of extents instead of a tree of indirect
+ * blocks, so reading a contiguous file needs no indirect blocks and readv()
+ * turns into one request to the layer below per extent.  Blocks are
+ * allocated next to the end of the last extent and extend it when possible.
+ * The layout of the file system is described in the file "extent.h".
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "extent.h"
+#include "file.h"     /* for the free space bitmap, same as a treedisk */
+
+#ifdef MKFS
+#include <stdio.h>
+#else
+#include "egos.h"
+#endif
+
+/* The superblock stays resident once the store is opened, and so does
+ * the free space bitmap block in use.  Inode blocks are larger than for a
+ * treedisk, so they are read from below and left to a cachedisk, if any.
+ * The overflow block of the file being accessed is kept in 'overflow'.
+ */
+struct extentdisk_state {
+    inode_store_t *below;                       /* inode store below */
+    unsigned int below_ino;                     /* inode number in the store below */
+    union extentdisk_block superblock;          /* pinned superblock */
+    struct treedisk_bitmap bitmap;              /* free space bitmap */
+    block_no last_alloc;                        /* last block allocated */
+    block_no cluster;                           /* # blocks per FS block */
+    block_no overflow_b;                        /* block in 'overflow', 0 if none */
+    int overflow_dirty;                         /* 'overflow' not written yet */
+    union extentdisk_block overflow;
+};
+
+/* An inode and the block holding it.
+ */
+struct extentdisk_snapshot {
+    block_no inode_blockno;
+    union extentdisk_block inodeblock;
+    struct extentdisk_inode *inode;
+};
+
+static block_t null_block;
+
+static block_no extentdisk_alloc_block(struct extentdisk_state *es, block_no near);
+
+static void panic(const char *s) {
+#ifdef MKFS
+    fprintf(stderr, "%s", s);
+    exit(1);
+#else
+    FATAL(s);
+#endif
+}
+
+static int extentdisk_get_snapshot(struct extentdisk_snapshot *snapshot,
+                                   struct extentdisk_state *es, unsigned int ino) {
+    if (ino >= es->superblock.superblock.n_inodeblocks * EXTENTDISK_INODES_PER_BLOCK) {
+        printf("!!EDERR: inode number too large %u\n", ino);
+        return -1;
+    }
+
+    snapshot->inode_blockno = 1 + ino / EXTENTDISK_INODES_PER_BLOCK;
+    if ((*es->below->read)(es->below, es->below_ino, snapshot->inode_blockno,
+                           (block_t *) &snapshot->inodeblock) < 0)
+        return -1;
+    snapshot->inode = &snapshot->inodeblock.inodeblock.inodes[ino % EXTENTDISK_INODES_PER_BLOCK];
+    return 0;
+}
+
+/* Return extent i of an inode, or NULL if i is beyond the extents the inode
+ * has room for.  An extent beyond NEXTENTS is in the overflow block, which
+ * is allocated if 'alloc' is set and there is a free FS block.
+ */
+static struct extentdisk_extent *extentdisk_extent(struct extentdisk_state *es,
+                                                   struct extentdisk_inode *inode,
+                                                   unsigned int i, int alloc) {
+    if (i < NEXTENTS)
+        return &inode->extents[i];
+    if (i >= NEXTENTS + EXTENTS_PER_BLOCK)
+        return NULL;
+
+    if (inode->overflow == 0) {
+        if (!alloc)
+            return NULL;
+        if ((inode->overflow = extentdisk_alloc_block(es, 0)) == 0)
+            return NULL;
+        memset(&es->overflow, 0, BLOCK_SIZE);
+        es->overflow_b = inode->overflow;
+        es->overflow_dirty = 1;
+    } else if (es->overflow_b != inode->overflow) {
+        if ((*es->below->read)(es->below, es->below_ino, inode->overflow, (block_t *) &es->overflow) < 0)
+            panic("extentdisk: overflow block");
+        es->overflow_b = inode->overflow;
+    }
+    return &es->overflow.overflowblock.extents[i - NEXTENTS];
+}
+
+/* Map block 'offset' of a file to block *b below.  Return the number of
+ * blocks in the same extent from *b on, or 0 if 'offset' is not mapped.
+ */
+static block_no extentdisk_map(struct extentdisk_state *es, struct extentdisk_inode *inode,
+                               block_no offset, block_no *b) {
+    block_no base = 0;
+    for (unsigned int i = 0; ; i++) {
+        struct extentdisk_extent *e = extentdisk_extent(es, inode, i, 0);
+        if (e == NULL || e->length == 0)
+            return 0;
+        if (offset < base + e->length) {
+            *b = e->start + (offset - base);
+            return e->length - (offset - base);
+        }
+        base += e->length;
+    }
+}
+
+/* Allocate a free FS block from the bitmap, the first one after the one
+ * of 'near', and return the number of its first block, or 0 if the inode
+ * store is full.
+ */
+static block_no extentdisk_alloc_block(struct extentdisk_state *es, block_no near) {
+    struct extentdisk_superblock *sb = &es->superblock.superblock;
+    block_no n = es->cluster, nblocks = sb->nblocks / n * n;
+    block_no first = (1 + sb->n_inodeblocks + sb->n_bitmapblocks + n - 1) / n * n;
+    if (near < first || near >= nblocks)
+        near = (es->last_alloc >= first) ? es->last_alloc : first - n;
+
+    block_no b = near / n * n;
+    for (block_no i = first; i < nblocks; i += n) {
+        if ((b += n) >= nblocks)
+            b = first;
+        if (!bitmap_test(&es->bitmap, b)) {
+            bitmap_set(&es->bitmap, b, n);
+            return es->last_alloc = b;
+        }
+    }
+
+    return 0;
+}
+
+/* Add a block at the end of a file and return its block number below,
+ * or 0 if there is no free FS block or no room for another extent.
+ * The block is the next one of the last FS block of the file if that is
+ * not full, or else the first one of a new FS block, which extends the
+ * last extent if it is right after it.
+ */
+static block_no extentdisk_append(struct extentdisk_state *es, struct extentdisk_inode *inode) {
+    unsigned int n = 0;
+    block_no mapped = 0;
+    struct extentdisk_extent *e, *last = NULL;
+    while ((e = extentdisk_extent(es, inode, n, 0)) != NULL && e->length != 0) {
+        mapped += e->length;
+        last = e;
+        n++;
+    }
+
+    if (mapped > inode->nblocks) {
+        block_no b = last->start + last->length - (mapped - inode->nblocks);
+        inode->nblocks++;
+        return b;
+    }
+
+    block_no b = extentdisk_alloc_block(es, last ? last->start + last->length - 1 : 0);
+    if (b == 0)
+        return 0;
+    if (last && b == last->start + last->length) {
+        last->length += es->cluster;
+        n--;
+    } else {
+        if ((e = extentdisk_extent(es, inode, n, 1)) == NULL) {
+            bitmap_clear(&es->bitmap, b, es->cluster);
+            return 0;
+        }
+        e->start = b;
+        e->length = es->cluster;
+    }
+    if (n >= NEXTENTS)
+        es->overflow_dirty = 1;
+
+    inode->nblocks++;
+    return b;
+}
+
+/* Return the number of blocks mapped by the extents of an inode.
+ */
+static block_no extentdisk_nmapped(struct extentdisk_state *es, struct extentdisk_inode *inode) {
+    block_no mapped = 0;
+    struct extentdisk_extent *e;
+    for (unsigned int i = 0; (e = extentdisk_extent(es, inode, i, 0)) != NULL && e->length != 0; i++)
+        mapped += e->length;
+    return mapped;
+}
+
+/* Undo the appends to an inode that mapped 'mapped' blocks and had the
+ * overflow block 'overflow' before: free the FS blocks allocated since
+ * and drop the changes to the overflow block.  The inode itself is a copy
+ * that is not written back.
+ */
+static void extentdisk_unappend(struct extentdisk_state *es, struct extentdisk_inode *inode,
+                                block_no mapped, block_no overflow) {
+    block_no base = 0;
+    struct extentdisk_extent *e;
+    for (unsigned int i = 0; (e = extentdisk_extent(es, inode, i, 0)) != NULL && e->length != 0; i++) {
+        for (block_no o = (base < mapped) ? mapped - base : 0; o < e->length; o += es->cluster)
+            bitmap_clear(&es->bitmap, e->start + o, es->cluster);
+        base += e->length;
+    }
+
+    if (inode->overflow != overflow)
+        bitmap_clear(&es->bitmap, inode->overflow, es->cluster);
+    es->overflow_b = 0;
+    es->overflow_dirty = 0;
+}
+
+static int extentdisk_getsize(inode_store_t *this_bs, unsigned int ino) {
+    struct extentdisk_snapshot snapshot;
+    if (extentdisk_get_snapshot(&snapshot, this_bs->state, ino) < 0)
+        return -1;
+    return snapshot.inode->nblocks;
+}
+
+static int extentdisk_setsize(inode_store_t *this_bs, unsigned int ino, block_no nblocks) {
+    return -1;
+}
+
+/* Read 'nblocks' blocks from block 'offset' on into blocks[], with one
+ * request to the layer below for every extent the blocks are in.
+ */
+static int extentdisk_readv(inode_store_t *this_bs, unsigned int ino, block_no offset,
+                            block_t *blocks, block_no nblocks) {
+    struct extentdisk_state *es = this_bs->state;
+    struct extentdisk_snapshot snapshot;
+    if (extentdisk_get_snapshot(&snapshot, es, ino) < 0)
+        return -1;
+    if (offset + nblocks > snapshot.inode->nblocks)
+        return -1;
+
+    while (nblocks > 0) {
+        block_no b, run = extentdisk_map(es, snapshot.inode, offset, &b);
+        if (run == 0)
+            return -1;
+        if (run > nblocks)
+            run = nblocks;
+        if ((*es->below->readv)(es->below, es->below_ino, b, blocks, run) < 0)
+            return -1;
+        offset += run;
+        blocks += run;
+        nblocks -= run;
+    }
+    return 0;
+}
+
+static int extentdisk_read(inode_store_t *this_bs, unsigned int ino, block_no offset, block_t *block) {
+    return extentdisk_readv(this_bs, ino, offset, block, 1);
+}
+
+/* Write *block at the given block number 'offset'.  Writing beyond the end
+ * of the file appends blocks, and blocks skipped over are filled with
+ * null bytes.  If the blocks cannot all be appended, the file is left as
+ * it was and -1 is returned.
+ */
+static int extentdisk_write(inode_store_t *this_bs, unsigned int ino, block_no offset, block_t *block) {
+    struct extentdisk_state *es = this_bs->state;
+    struct extentdisk_snapshot snapshot;
+    if (extentdisk_get_snapshot(&snapshot, es, ino) < 0)
+        return -1;
+
+    block_no b;
+    if (offset < snapshot.inode->nblocks) {
+        if (extentdisk_map(es, snapshot.inode, offset, &b) == 0)
+            panic("extentdisk_write: block not mapped\n");
+    } else {
+        block_no mapped = extentdisk_nmapped(es, snapshot.inode), overflow = snapshot.inode->overflow;
+        while (snapshot.inode->nblocks <= offset) {
+            if ((b = extentdisk_append(es, snapshot.inode)) == 0) {
+                extentdisk_unappend(es, snapshot.inode, mapped, overflow);
+                bitmap_flush(&es->bitmap);
+                return -1;
+            }
+            if (snapshot.inode->nblocks <= offset &&
+                (*es->below->write)(es->below, es->below_ino, b, &null_block) < 0)
+                panic("extentdisk_write: hole");
+        }
+
+        if (es->overflow_dirty) {
+            if ((*es->below->write)(es->below, es->below_ino, es->overflow_b, (block_t *) &es->overflow) < 0)
+                panic("extentdisk_write: overflow block");
+            es->overflow_dirty = 0;
+        }
+        if ((*es->below->write)(es->below, es->below_ino, snapshot.inode_blockno,
+                                (block_t *) &snapshot.inodeblock) < 0)
+            panic("extentdisk_write: inode block");
+        bitmap_flush(&es->bitmap);
+    }
+
+    return (*es->below->write)(es->below, es->below_ino, b, block);
+}
+
+inode_store_t *extentdisk_init(inode_store_t *below, unsigned int below_ino) {
+    struct extentdisk_state *es = malloc(sizeof(struct extentdisk_state));
+    memset(es, 0, sizeof(struct extentdisk_state));
+    es->below = below;
+    es->below_ino = below_ino;
+
+    if ((*below->read)(below, below_ino, 0, (block_t *) &es->superblock) < 0)
+        panic("extentdisk_init: superblock");
+    if (es->superblock.superblock.magic != EXTENTDISK_MAGIC) {
+        free(es);
+        return NULL;
+    }
+    block_no block_size = es->superblock.superblock.block_size;
+    es->cluster = (block_size == 0) ? 1 : block_size / BLOCK_SIZE;
+
+    struct extentdisk_superblock *sb = &es->superblock.superblock;
+    bitmap_init(&es->bitmap, below, below_ino, 1 + sb->n_inodeblocks, sb->n_bitmapblocks);
+
+    /* Grow the file system to the size of the inode below (see file.h).
+     */
+    int size = (*below->getsize)(below, below_ino);
+    block_no oldsize = sb->nblocks / es->cluster * es->cluster;
+    block_no newsize = (size < 0) ? 0 : (block_no) size / es->cluster * es->cluster;
+    if (newsize > oldsize) {
+        printf("extentdisk: growing the file system from %u to %u blocks\n", sb->nblocks, size);
+        bitmap_grow(&es->bitmap, oldsize, newsize, es->cluster);
+        if (below->sync != NULL && (*below->sync)(below) < 0)
+            panic("extentdisk_init: bitmap");
+        sb->nblocks = size;
+        if ((*below->write)(below, below_ino, 0, (block_t *) &es->superblock) < 0)
+            panic("extentdisk_init: superblock");
+    }
+
+    inode_store_t *this_bs = malloc(sizeof(inode_store_t));
+    memset(this_bs, 0, sizeof(inode_store_t));
+    this_bs->state = es;
+    this_bs->getsize = extentdisk_getsize;
+    this_bs->setsize = extentdisk_setsize;
+    this_bs->read = extentdisk_read;
+    this_bs->write = extentdisk_write;
+    this_bs->readv = extentdisk_readv;
+    return this_bs;
+}
+
+/* Create a new extentdisk file system, with the free space bitmap set up
+ * the same way as for a treedisk.
+ */
+int extentdisk_create(inode_store_t *below, unsigned int below_ino, unsigned int ninodes,
+                      unsigned int block_size) {
+    if (sizeof(union extentdisk_block) != BLOCK_SIZE)
+        panic("extentdisk_create: block has wrong size");
+    if (block_size < BLOCK_SIZE || block_size % BLOCK_SIZE != 0 ||
+        (block_size & (block_size - 1)) != 0 || block_size / BLOCK_SIZE > BITS_PER_BLOCK) {
+        printf("extentdisk_create: bad FS block size %u\n", block_size);
+        return -1;
+    }
+    unsigned int cluster = block_size / BLOCK_SIZE;
+
+    unsigned int n_inodeblocks = (ninodes + EXTENTDISK_INODES_PER_BLOCK - 1) / EXTENTDISK_INODES_PER_BLOCK;
+    unsigned int nblocks = (*below->getsize)(below, below_ino);
+    unsigned int n_bitmapblocks = (nblocks + BITS_PER_BLOCK - 1) / BITS_PER_BLOCK;
+    unsigned int nused = (1 + n_inodeblocks + n_bitmapblocks + cluster - 1) / cluster * cluster;
+    if (nblocks < nused + cluster) {
+        printf("extentdisk_create: too few blocks\n");
+        return -1;
+    }
+
+    union extentdisk_block superblock;
+    if ((*below->read)(below, below_ino, 0, (block_t *) &superblock) < 0)
+        return -1;
+    if (superblock.superblock.magic == EXTENTDISK_MAGIC)
+        return 0;
+
+    memset(&superblock, 0, BLOCK_SIZE);
+    superblock.superblock.magic = EXTENTDISK_MAGIC;
+    superblock.superblock.n_inodeblocks = n_inodeblocks;
+    superblock.superblock.n_bitmapblocks = n_bitmapblocks;
+    superblock.superblock.nblocks = nblocks;
+    superblock.superblock.block_size = block_size;
+    setup_bitmap(below, below_ino, 1 + n_inodeblocks, n_bitmapblocks,
+                 nused, nblocks / cluster * cluster);
+    if ((*below->write)(below, below_ino, 0, (block_t *) &superblock) < 0)
+        return -1;
+
+    for (int i = 1; i <= n_inodeblocks; i++)
+        if ((*below->write)(below, below_ino, i, &null_block) < 0)
+            return -1;
+    return 0;
+}
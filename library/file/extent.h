@@ -0,0 +1,55 @@
+/* Description: the layout of an extentdisk file system
+ * An extentdisk is an alternative to a treedisk (see file.h) with the same
+ * superblock, inode blocks and free space bitmap, except that an inode maps
+ * the blocks of a file with extents instead of a tree of indirect blocks.
+ * An extent is a run of 'length' contiguous blocks starting at block 'start'
+ * and the extents of a file cover its blocks in order.  The first NEXTENTS
+ * extents are in the inode; if a file needs more, the inode points to an
+ * overflow block holding EXTENTS_PER_BLOCK more.  An extent of length 0
+ * ends the list.  The superblock starts with EXTENTDISK_MAGIC, so that a
+ * file server can tell an extentdisk from a treedisk.  Space is allocated
+ * in FS blocks of block_size bytes like for a treedisk, so the last extent
+ * of a file may go beyond its last block up to the end of an FS block.
+ */
+#pragma once
+#include "inode.h"
+
+#define EXTENTDISK_MAGIC          0x45585444    /* "EXTD" */
+#define NEXTENTS                  3
+#define EXTENTS_PER_BLOCK         (BLOCK_SIZE / sizeof(struct extentdisk_extent))
+#define EXTENTDISK_INODES_PER_BLOCK  (BLOCK_SIZE / sizeof(struct extentdisk_inode))
+
+struct extentdisk_superblock {
+    block_no magic;                     /* EXTENTDISK_MAGIC */
+    block_no n_inodeblocks;             /* # blocks with inodes */
+    block_no n_bitmapblocks;            /* # blocks of the free space bitmap */
+    block_no nblocks;                   /* # blocks in the file system */
+    block_no block_size;                /* bytes per FS block, 0 if BLOCK_SIZE */
+};
+
+struct extentdisk_extent {
+    block_no start;                     /* first block of the run */
+    block_no length;                    /* # blocks in the run */
+};
+
+struct extentdisk_inode {
+    block_no nblocks;                   /* total size of the file */
+    block_no overflow;                  /* block with more extents, 0 if none */
+    struct extentdisk_extent extents[NEXTENTS];
+};
+
+struct extentdisk_inodeblock {
+    struct extentdisk_inode inodes[EXTENTDISK_INODES_PER_BLOCK];
+};
+
+struct extentdisk_overflowblock {
+    struct extentdisk_extent extents[EXTENTS_PER_BLOCK];
+};
+
+union extentdisk_block {
+    block_t datablock;
+    struct extentdisk_superblock superblock;
+    struct extentdisk_inodeblock inodeblock;
+    struct extentdisk_overflowblock overflowblock;
+    unsigned char bits[BLOCK_SIZE];
+};
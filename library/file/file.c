@@ -10,16 +10,27 @@
  * a so-called "inode number", which indexes into an array of inodes.  The 
  * interface is as follows:
  *
- *		void treedisk_create(inode_store_t *below, unsigned int below_ino, unsigned int ninodes)
+ *		void treedisk_create(inode_store_t *below, unsigned int below_ino, unsigned int ninodes,
+ *		                     unsigned int block_size)
  *			Initializes the underlying inode store "below" with a file system
  *			stored within inode below_ino. If "below" is a simple
  * 			non-virtualized inode store like the disk server, below_ino is
  * 			probably 0. The file system consists of one "superblock", a number
  * 			of blocks containing inodes, and the remaining blocks explained
- * 			below. The file system can support up to ninodes inodes.
+ * 			below. The file system can support up to ninodes inodes, and
+ * 			allocates space in FS blocks of block_size bytes.
  *
  *		inode_store_t *treedisk_init(inode_store_t *below, unsigned int below_ino)
  *			Opens a virtual inode store within inode below_ino of the inode store below.
+ *			If inode below_ino has grown since the file system was created,
+ *			the file system grows to its size.
+ *
+ *		int treedisk_alloc_inode(inode_store_t *this_bs)
+ *			Returns a free inode number and marks it allocated, or -1 if
+ *			there is none or the file system keeps no inode allocation bitmap.
+ *
+ *		int treedisk_free_inode(inode_store_t *this_bs, unsigned int ino)
+ *			Frees the blocks of inode ino and marks it free.
  *
  * The layout of the file system is described in the file "file.h".
  */
@@ -36,20 +47,49 @@
 
 /* Temporary information about the file system and a particular inode.
  * Convenient for all operations. See "file.h" for field details.
+ * The superblock and inode block point into the pinned copies in
+ * struct treedisk_state.
  */
 struct treedisk_snapshot {
-    union treedisk_block superblock; 
-    union treedisk_block inodeblock; 
+    union treedisk_block *superblock;
+    union treedisk_block *inodeblock;
     block_no inode_blockno;
     struct treedisk_inode *inode;
 };
 
+/* A recently used indirect block, so that walking down the tree of a file
+ * does not read the same indirect blocks from below again and again.
+ */
+#define TREEDISK_NINDIR   4
+struct treedisk_indircache {
+    block_no b;					/* block number, 0 if unused */
+    unsigned int last_use;			/* for replacing the LRU entry */
+    struct treedisk_indirblock tib;
+};
+
 /* The state of a virtual inode store, which is identified by an inode number.
+ * The superblock and the inode blocks stay resident once the store is opened;
+ * every modification of them is written through to the inode store below.
+ * So do the inline blocks if there are at most TREEDISK_PIN_NINLINEBLOCKS of
+ * them, except on the Arty board whose app memory cannot hold them; else the
+ * inline block in use is read into 'inlinebuf' instead.
  */
 struct treedisk_state {
     inode_store_t *below;			/* inode store below */
     unsigned int below_ino;			/* inode number to use for the inode store below */
     unsigned int ninodes;			/* number of inodes in the treedisk */
+    union treedisk_block superblock;		/* pinned superblock */
+    union treedisk_block *inodeblocks;		/* pinned inode blocks */
+    union treedisk_block *inlineblocks;		/* pinned inline blocks, or NULL */
+    union treedisk_block inlinebuf;		/* inline block if not pinned */
+    block_no inlinebuf_no;			/* block in inlinebuf, 0 if none */
+    struct treedisk_bitmap bitmap;		/* free space bitmap */
+    block_no last_alloc;			/* last block allocated */
+    block_no cluster;				/* # blocks per FS block */
+    unsigned int log_cluster;			/* log2(cluster) */
+    block_no first_cluster;			/* first FS block after the bitmap */
+    struct treedisk_indircache indircache[TREEDISK_NINDIR];
+    unsigned int clock;				/* incremented at every indirect block access */
 };
 
 static unsigned int log_rpb;                    /* log2(REFS_PER_BLOCK) */
@@ -75,73 +115,243 @@ static block_no log_shift_r(block_no x, unsigned int nbits){
 }
 
 /* Get a snapshot of the file system, including the superblock and the block
- * containing the inode, from the inode store below.
+ * containing the inode, from the pinned copies in the treedisk state.
  */
 static int treedisk_get_snapshot(struct treedisk_snapshot *snapshot,
                                  struct treedisk_state *ts, unsigned int inode_no){
     /* Get the superblock.
      */
-    if ((*ts->below->read)(ts->below, ts->below_ino, 0, (block_t *) &snapshot->superblock) < 0)
-        return -1;
+    snapshot->superblock = &ts->superblock;
 
     /* Check the inode number.
      */
-    if (inode_no >= snapshot->superblock.superblock.n_inodeblocks * INODES_PER_BLOCK) {
-        printf("!!TDERR: inode number too large %u %u\n", inode_no, snapshot->superblock.superblock.n_inodeblocks);
+    if (inode_no >= snapshot->superblock->superblock.n_inodeblocks * INODES_PER_BLOCK) {
+        printf("!!TDERR: inode number too large %u %u\n", inode_no, snapshot->superblock->superblock.n_inodeblocks);
         return -1;
     }
 
     /* Find the inode.
      */
     snapshot->inode_blockno = 1 + inode_no / INODES_PER_BLOCK;
-    if ((*ts->below->read)(ts->below, ts->below_ino, snapshot->inode_blockno, (block_t *) &snapshot->inodeblock) < 0)
+    snapshot->inodeblock = &ts->inodeblocks[snapshot->inode_blockno - 1];
+    snapshot->inode = &snapshot->inodeblock->inodeblock.inodes[inode_no % INODES_PER_BLOCK];
+    return 0;
+}
+
+/* Return the inline slot of an inode, and the block holding it in *blockno
+ * and *inlineblock.  The inline block is read if it is not pinned.
+ */
+static char *treedisk_get_inline(struct treedisk_state *ts, unsigned int inode_no,
+                                 block_no *blockno, union treedisk_block **inlineblock){
+    block_no i = inode_no / INLINES_PER_BLOCK;
+    *blockno = 1 + ts->superblock.superblock.n_inodeblocks + i;
+    if (ts->inlineblocks != NULL) {
+        *inlineblock = &ts->inlineblocks[i];
+    }
+    else {
+        if (ts->inlinebuf_no != *blockno) {
+            if ((*ts->below->read)(ts->below, ts->below_ino, *blockno, (block_t *) &ts->inlinebuf) < 0)
+                return NULL;
+            ts->inlinebuf_no = *blockno;
+        }
+        *inlineblock = &ts->inlinebuf;
+    }
+    return (*inlineblock)->inlineblock.data[inode_no % INLINES_PER_BLOCK];
+}
+
+/* Copy the data of an inline file into *block.
+ */
+static int treedisk_read_inline(struct treedisk_state *ts, unsigned int inode_no, block_t *block){
+    block_no blockno;
+    union treedisk_block *inlineblock;
+    char *data = treedisk_get_inline(ts, inode_no, &blockno, &inlineblock);
+    if (data == NULL)
         return -1;
+    memset(block, 0, BLOCK_SIZE);
+    memcpy(block, data, TREEDISK_INLINE_SIZE);
+    return 0;
+}
 
-    snapshot->inode = &snapshot->inodeblock.inodeblock.inodes[inode_no % INODES_PER_BLOCK];
+/* Read indirect block b, from the indirect block cache if possible.
+ */
+static int treedisk_read_indir(struct treedisk_state *ts, block_no b, struct treedisk_indirblock *tib){
+    struct treedisk_indircache *victim = &ts->indircache[0];
+    for (int i = 0; i < TREEDISK_NINDIR; i++) {
+        struct treedisk_indircache *ic = &ts->indircache[i];
+        if (ic->b == b) {
+            ic->last_use = ++ts->clock;
+            memcpy(tib, &ic->tib, BLOCK_SIZE);
+            return 0;
+        }
+        if (ic->last_use < victim->last_use)
+            victim = ic;
+    }
+
+    if ((*ts->below->read)(ts->below, ts->below_ino, b, (block_t *) tib) < 0)
+        return -1;
+    victim->b = b;
+    victim->last_use = ++ts->clock;
+    memcpy(&victim->tib, tib, BLOCK_SIZE);
     return 0;
 }
 
-/* Allocate a block from the free list.
+/* Write indirect block b through the indirect block cache.
  */
-static block_no treedisk_alloc_block(struct treedisk_state *ts, struct treedisk_snapshot *snapshot){
-    block_no b;
-    static int count;
-    count++;
+static int treedisk_write_indir(struct treedisk_state *ts, block_no b, struct treedisk_indirblock *tib){
+    for (int i = 0; i < TREEDISK_NINDIR; i++)
+        if (ts->indircache[i].b == b)
+            memcpy(&ts->indircache[i].tib, tib, BLOCK_SIZE);
 
-    if ((b = snapshot->superblock.superblock.free_list) == 0)
-        panic("treedisk_alloc_block: inode store is full\n");
+    return (*ts->below->write)(ts->below, ts->below_ino, b, (block_t *) tib);
+}
 
-    /* Read the freelist block and scan for a free block reference.
-     */
-    union treedisk_block freelistblock;
-    (*ts->below->read)(ts->below, ts->below_ino, b, (block_t *) &freelistblock);
+#define BITMAP_TEST(bitmap, b)  ((bitmap)[(b) / 8] & (1 << ((b) % 8)))
+#define BITMAP_SET(bitmap, b)   ((bitmap)[(b) / 8] |= (1 << ((b) % 8)))
+#define BITMAP_CLEAR(bitmap, b) ((bitmap)[(b) / 8] &= ~(1 << ((b) % 8)))
 
-    unsigned int i;
-    for (i = REFS_PER_BLOCK; --i > 0;)
-        if (freelistblock.freelistblock.refs[i] != 0) {
-            break;
-        }
+void bitmap_init(struct treedisk_bitmap *bm, inode_store_t *below, unsigned int below_ino,
+                 block_no start, block_no n_bitmapblocks){
+    memset(bm, 0, sizeof(*bm));
+    bm->below = below;
+    bm->below_ino = below_ino;
+    bm->start = start;
+    bm->n_bitmapblocks = n_bitmapblocks;
+    bm->index = (block_no) -1;
+}
 
-    /* If there is a free block reference use that.  Otherwise use
-     * the free list block itself and update the superblock.
-     */
-    block_no free_blockno;
-    if (i == 0) {
-        free_blockno = b;
-        snapshot->superblock.superblock.free_list = freelistblock.freelistblock.refs[0];
-        if ((*ts->below->write)(ts->below, ts->below_ino, 0, (block_t *) &snapshot->superblock) < 0) {
-            panic("treedisk_alloc_block: superblock");
+/* Block number of bitmap block i (see file.h).
+ */
+static block_no bitmap_blockno(struct treedisk_bitmap *bm, block_no i){
+    return (i < bm->n_bitmapblocks) ? bm->start + i : i * BITS_PER_BLOCK;
+}
+
+/* Write the bitmap block in the buffer back if it has changed.
+ */
+void bitmap_flush(struct treedisk_bitmap *bm){
+    if (!bm->dirty)
+        return;
+    if ((*bm->below->write)(bm->below, bm->below_ino, bitmap_blockno(bm, bm->index), (block_t *) &bm->buf) < 0)
+        panic("bitmap_flush");
+    bm->dirty = 0;
+}
+
+/* Return the bits of the bitmap block holding the bit of block b.
+ */
+static unsigned char *bitmap_get(struct treedisk_bitmap *bm, block_no b){
+    block_no i = b / BITS_PER_BLOCK;
+    if (bm->index != i) {
+        bitmap_flush(bm);
+        if ((*bm->below->read)(bm->below, bm->below_ino, bitmap_blockno(bm, i), (block_t *) &bm->buf) < 0)
+            panic("bitmap_get");
+        bm->index = i;
+    }
+    return bm->buf.bits;
+}
+
+int bitmap_test(struct treedisk_bitmap *bm, block_no b){
+    return BITMAP_TEST(bitmap_get(bm, b), b % BITS_PER_BLOCK) != 0;
+}
+
+/* Set or clear the bits of the 'n' blocks from block b on, which are in the
+ * same bitmap block, e.g., an FS block.
+ */
+void bitmap_set(struct treedisk_bitmap *bm, block_no b, block_no n){
+    unsigned char *bits = bitmap_get(bm, b);
+    for (block_no j = 0; j < n; j++)
+        BITMAP_SET(bits, (b + j) % BITS_PER_BLOCK);
+    bm->dirty = 1;
+}
+
+void bitmap_clear(struct treedisk_bitmap *bm, block_no b, block_no n){
+    unsigned char *bits = bitmap_get(bm, b);
+    for (block_no j = 0; j < n; j++)
+        BITMAP_CLEAR(bits, (b + j) % BITS_PER_BLOCK);
+    bm->dirty = 1;
+}
+
+/* Grow the bitmap of a file system of 'oldsize' blocks to 'newsize' blocks,
+ * both multiples of 'cluster' blocks per FS block.  The blocks in between
+ * are free, except for the first FS block of every BITS_PER_BLOCK blocks
+ * holding its own bitmap block (see file.h).
+ */
+void bitmap_grow(struct treedisk_bitmap *bm, block_no oldsize, block_no newsize, block_no cluster){
+    for (block_no i = oldsize / BITS_PER_BLOCK; i * BITS_PER_BLOCK < newsize; i++) {
+        block_no start = i * BITS_PER_BLOCK;
+        unsigned char *bits;
+        if (start < oldsize) {
+            bits = bitmap_get(bm, start);
         }
+        else {
+            bitmap_flush(bm);
+            memset(&bm->buf, 0xff, BLOCK_SIZE);
+            bm->index = i;
+            bits = bm->buf.bits;
+        }
+
+        for (block_no b = (start > oldsize) ? start : oldsize; b < newsize && b < start + BITS_PER_BLOCK; b++)
+            BITMAP_CLEAR(bits, b - start);
+        if (start >= oldsize && i >= bm->n_bitmapblocks)
+            for (block_no j = 0; j < cluster; j++)
+                BITMAP_SET(bits, j);
+        bm->dirty = 1;
     }
-    else {
-        free_blockno = freelistblock.freelistblock.refs[i];
-        freelistblock.freelistblock.refs[i] = 0;
-        if ((*ts->below->write)(ts->below, ts->below_ino, b, (block_t *) &freelistblock) < 0) {
-            panic("treedisk_alloc_block: freelistblock");
+    bitmap_flush(bm);
+}
+
+/* Return whether at least 'n' FS blocks are free.  An update checks this
+ * before it changes anything, so that it does not run out of FS blocks
+ * halfway.  The search starts where treedisk_alloc_block() would.
+ */
+static int treedisk_has_free(struct treedisk_state *ts, block_no n){
+    struct treedisk_superblock *sb = &ts->superblock.superblock;
+    block_no first = ts->first_cluster, nclusters = sb->nblocks >> ts->log_cluster;
+    block_no c = ts->last_alloc >> ts->log_cluster;
+    for (block_no i = first; i < nclusters && n > 0; i++) {
+        if (++c >= nclusters || c < first)
+            c = first;
+        if (!bitmap_test(&ts->bitmap, c << ts->log_cluster))
+            n--;
+    }
+    return n == 0;
+}
+
+/* Allocate a free FS block from the bitmap and return the number of its
+ * first block.  Take the first free FS block after the one of 'near', so
+ * that the blocks of a file written in order are contiguous.  The bitmap
+ * block is written back by bitmap_flush().  The callers have checked with
+ * treedisk_has_free() that there is a free FS block.
+ */
+static block_no treedisk_alloc_block(struct treedisk_state *ts, block_no near){
+    struct treedisk_superblock *sb = &ts->superblock.superblock;
+    block_no first = ts->first_cluster, nclusters = sb->nblocks >> ts->log_cluster;
+    if (near < (first << ts->log_cluster) || near >= sb->nblocks)
+        near = (ts->last_alloc >= (first << ts->log_cluster)) ? ts->last_alloc : (first - 1) << ts->log_cluster;
+
+    block_no c = near >> ts->log_cluster;
+    for (block_no i = first; i < nclusters; i++) {
+        if (++c >= nclusters)
+            c = first;
+        block_no b = c << ts->log_cluster;
+        if (!bitmap_test(&ts->bitmap, b)) {
+            bitmap_set(&ts->bitmap, b, ts->cluster);
+            return ts->last_alloc = b;
         }
     }
 
-    return free_blockno;
+    panic("treedisk_alloc_block: inode store is full\n");
+    return 0;
+}
+
+/* Free the FS block starting at block b in the bitmap.  It may have been
+ * an indirect block, so it is also dropped from the indirect block cache.
+ */
+static void treedisk_free_block(struct treedisk_state *ts, block_no b){
+    bitmap_clear(&ts->bitmap, b, ts->cluster);
+    for (int i = 0; i < TREEDISK_NINDIR; i++)
+        if (ts->indircache[i].b == b) {
+            ts->indircache[i].b = 0;
+            ts->indircache[i].last_use = 0;
+        }
 }
 
 /* Retrieve the number of blocks in the file referenced by 'this_bs'.  This
@@ -156,10 +366,188 @@ static int treedisk_getsize(inode_store_t *this_bs, unsigned int ino){
     return snapshot.inode->nblocks; 
 }
 
-/* Set the size of the file 'this_bs' to 'nblocks'.
+/* Number of FS blocks of a file of 'nblocks' blocks.
+ */
+static block_no treedisk_nclusters(struct treedisk_state *ts, block_no nblocks){
+    return (nblocks + ts->cluster - 1) >> ts->log_cluster;
+}
+
+/* Number of levels of indirect blocks in the tree of a file of 'nclusters'
+ * FS blocks.
+ */
+static unsigned int treedisk_nlevels(block_no nclusters){
+    unsigned int nlevels = 0;
+    if (nclusters > 0)
+        while (log_shift_r(nclusters - 1, nlevels * log_rpb) != 0) {
+            nlevels++;
+        }
+    return nlevels;
+}
+
+/* Find FS block 'c' in the tree rooted at b, which has 'nlevels' levels
+ * of indirect blocks, and return the number of its first block in *cb,
+ * or 0 for a hole.
+ */
+static int treedisk_map(struct treedisk_state *ts, block_no b, unsigned int nlevels,
+                        block_no c, block_no *cb){
+    while (b != 0 && nlevels > 0) {
+        struct treedisk_indirblock tib;
+        if (treedisk_read_indir(ts, b, &tib) < 0)
+            return -1;
+        nlevels--;
+        b = tib.refs[log_shift_r(c, nlevels * log_rpb) % REFS_PER_BLOCK];
+    }
+    *cb = b;
+    return 0;
+}
+
+/* A file grows from 'oldsize' to 'newsize' blocks.  The blocks in between
+ * that are in the last FS block of the file may hold stale data, so they
+ * are filled with null bytes.
+ */
+static void treedisk_zero_tail(struct treedisk_state *ts, struct treedisk_inode *inode,
+                               block_no oldsize, block_no newsize){
+    block_no mask = ts->cluster - 1, cb;
+    if ((oldsize & mask) == 0 || inode->root == TREEDISK_INLINE)
+        return;
+    if (treedisk_map(ts, inode->root, treedisk_nlevels(treedisk_nclusters(ts, oldsize)),
+                     oldsize >> ts->log_cluster, &cb) < 0)
+        panic("treedisk_zero_tail: indirect block");
+
+    for (block_no o = oldsize; cb != 0 && o < newsize && (o & mask) != 0; o++)
+        if ((*ts->below->write)(ts->below, ts->below_ino, cb + (o & mask), &null_block) < 0)
+            panic("treedisk_zero_tail");
+}
+
+/* Insert indirect blocks above the root until the tree has 'nlevels_after'
+ * levels.  The caller writes the inode back.
+ */
+static void treedisk_grow(struct treedisk_state *ts, struct treedisk_inode *inode,
+                          unsigned int nlevels, unsigned int nlevels_after){
+    while (nlevels_after > nlevels) {
+        block_no indir = treedisk_alloc_block(ts, inode->root);
+
+        /* Insert the new indirect block into the inode.
+         */
+        struct treedisk_indirblock tib;
+        memset(&tib, 0, BLOCK_SIZE);
+        tib.refs[0] = inode->root;
+        inode->root = indir;
+        if (treedisk_write_indir(ts, indir, &tib) < 0) {
+            panic("treedisk_grow: indirect block");
+        }
+
+        nlevels++;
+    }
+}
+
+/* Free the blocks after the first 'keep' blocks in the tree rooted at b,
+ * which has 'nlevels' levels of indirect blocks.  Return the new root of
+ * the tree, i.e., 0 if nothing is kept.
+ */
+static block_no treedisk_truncate(struct treedisk_state *ts, block_no b,
+                                  unsigned int nlevels, block_no keep){
+    if (b == 0 || (nlevels == 0 && keep > 0))
+        return b;
+    if (nlevels == 0) {
+        treedisk_free_block(ts, b);
+        return 0;
+    }
+
+    struct treedisk_indirblock tib;
+    if (treedisk_read_indir(ts, b, &tib) < 0)
+        panic("treedisk_truncate: indirect block");
+
+    /* The first 'full' children are kept entirely.
+     */
+    unsigned int shift = (nlevels - 1) * log_rpb;
+    block_no full = log_shift_r(keep, shift);
+    int dirty = 0;
+    for (block_no i = full; i < REFS_PER_BLOCK; i++) {
+        block_no child_keep = (i == full) ? keep - (full << shift) : 0;
+        block_no child = treedisk_truncate(ts, tib.refs[i], nlevels - 1, child_keep);
+        if (child != tib.refs[i]) {
+            tib.refs[i] = child;
+            dirty = 1;
+        }
+    }
+
+    if (keep == 0) {
+        treedisk_free_block(ts, b);
+        return 0;
+    }
+    if (dirty && treedisk_write_indir(ts, b, &tib) < 0)
+        panic("treedisk_truncate: indirect block");
+    return b;
+}
+
+/* Set the size of the file 'this_bs' to 'nblocks' and return the old size.
+ * Shrinking frees the blocks beyond the new size, as well as the indirect
+ * blocks and tree levels no longer needed.  Growing only adds tree levels
+ * and clears the rest of the last FS block, so that the new blocks read as
+ * holes until they are written.
  */
 static int treedisk_setsize(inode_store_t *this_bs, unsigned int ino, block_no nblocks){
-    return -1;
+    struct treedisk_state *ts = this_bs->state;
+
+    /* Get info from underlying file system.
+     */
+    struct treedisk_snapshot snapshot;
+    if (treedisk_get_snapshot(&snapshot, ts, ino) < 0)
+        return -1;
+    struct treedisk_inode *inode = snapshot.inode;
+    block_no oldsize = inode->nblocks;
+    if (nblocks == oldsize)
+        return oldsize;
+
+    unsigned int nlevels = treedisk_nlevels(treedisk_nclusters(ts, oldsize));
+    unsigned int nlevels_after = treedisk_nlevels(treedisk_nclusters(ts, nblocks));
+    if (nblocks > oldsize && !treedisk_has_free(ts, nlevels_after + 1))
+        return -1;
+    if (inode->root == TREEDISK_INLINE) {
+        /* An inline file stays inline with one block, and its data moves
+         * to a data block if it grows.
+         */
+        if (nblocks == 0) {
+            inode->root = 0;
+        }
+        else if (nblocks > 1) {
+            block_t data;
+            if (treedisk_read_inline(ts, ino, &data) < 0)
+                return -1;
+            inode->root = treedisk_alloc_block(ts, 0);
+            if ((*ts->below->write)(ts->below, ts->below_ino, inode->root, &data) < 0)
+                panic("treedisk_setsize: inline data");
+        }
+    }
+    else if (nblocks < oldsize) {
+        inode->root = treedisk_truncate(ts, inode->root, nlevels, treedisk_nclusters(ts, nblocks));
+
+        /* Only the first child of a root that is not needed any more can
+         * still have blocks.
+         */
+        while (nlevels > nlevels_after) {
+            if (inode->root != 0) {
+                struct treedisk_indirblock tib;
+                if (treedisk_read_indir(ts, inode->root, &tib) < 0)
+                    panic("treedisk_setsize: indirect block");
+                treedisk_free_block(ts, inode->root);
+                inode->root = tib.refs[0];
+            }
+            nlevels--;
+        }
+    }
+
+    if (nblocks > oldsize && inode->root != 0 && inode->root != TREEDISK_INLINE) {
+        treedisk_zero_tail(ts, inode, oldsize, nblocks);
+        treedisk_grow(ts, inode, nlevels, nlevels_after);
+    }
+    inode->nblocks = nblocks;
+
+    if ((*ts->below->write)(ts->below, ts->below_ino, snapshot.inode_blockno, (block_t *) snapshot.inodeblock) < 0)
+        panic("treedisk_setsize: inode block");
+    bitmap_flush(&ts->bitmap);
+    return oldsize;
 }
 
 /* Read a block at the given block number 'offset' and return in *block.
@@ -180,44 +568,81 @@ static int treedisk_read(inode_store_t *this_bs, unsigned int ino, block_no offs
         return -1;
     }
 
-    /* Figure out how many levels there are in the tree.
+    /* An inline file is in the inline table.
      */
-    unsigned int nlevels = 0;
-    if (snapshot.inode->nblocks > 0)
-        while (log_shift_r(snapshot.inode->nblocks - 1, nlevels * log_rpb) != 0) {
-            nlevels++;
-        }
+    if (snapshot.inode->root == TREEDISK_INLINE)
+        return treedisk_read_inline(ts, ino, block);
 
-    /* Walk down from the root block.
+    /* Find the FS block by walking down the tree from the root block.
+     * If there's a hole, return the null block.
      */
-    block_no b = snapshot.inode->root;
-    for (;;) {
-        /* If there's a hole, return the null block.
-         */
-        if (b == 0) {
-            memset(block, 0, BLOCK_SIZE);
-            return 0;
-        }
+    block_no b;
+    unsigned int nlevels = treedisk_nlevels(treedisk_nclusters(ts, snapshot.inode->nblocks));
+    int result = treedisk_map(ts, snapshot.inode->root, nlevels, offset >> ts->log_cluster, &b);
+    if (result < 0)
+        return result;
+    if (b == 0) {
+        memset(block, 0, BLOCK_SIZE);
+        return 0;
+    }
+    return (*ts->below->read)(ts->below, ts->below_ino, b + (offset & (ts->cluster - 1)), block);
+}
 
-        /* Return the next level.  If the last level, we're done.
-         */
-        int result = (*ts->below->read)(ts->below, ts->below_ino, b, block);
-        if (result < 0)
-            return result;
-        if (nlevels == 0)
-            return 0;
+/* Read 'nblocks' consecutive blocks.  The blocks of a file in one FS block
+ * are contiguous, and so are FS blocks allocated one after the other, so
+ * a run of them is read from below in one request.
+ */
+static int treedisk_readv(inode_store_t *this_bs, unsigned int ino, block_no offset, block_t *blocks, block_no nblocks){
+    struct treedisk_state *ts = this_bs->state;
+    struct treedisk_snapshot snapshot;
+    if (treedisk_get_snapshot(&snapshot, ts, ino) < 0)
+        return -1;
+    if (offset + nblocks > snapshot.inode->nblocks)
+        return -1;
+    if (nblocks == 0)
+        return 0;
+    if (snapshot.inode->root == TREEDISK_INLINE)
+        return treedisk_read(this_bs, ino, offset, blocks);
+
+    unsigned int nlevels = treedisk_nlevels(treedisk_nclusters(ts, snapshot.inode->nblocks));
+    block_no mask = ts->cluster - 1;
+    for (block_no i = 0; i < nblocks; ) {
+        block_no b, next;
+        if (treedisk_map(ts, snapshot.inode->root, nlevels, (offset + i) >> ts->log_cluster, &b) < 0)
+            return -1;
 
-        /* The block is an indirect block.  Figure out the index into this
-         * block and get the block number.
+        /* Extend the run to the end of this FS block and over the next
+         * ones that follow it on the disk.
          */
-        nlevels--;
-        struct treedisk_indirblock *tib = (struct treedisk_indirblock *) block;
-        unsigned int index = log_shift_r(offset, nlevels * log_rpb) % REFS_PER_BLOCK;
-        b = tib->refs[index];
+        block_no n = ts->cluster - ((offset + i) & mask);
+        if (b != 0)
+            b += (offset + i) & mask;
+        while (b != 0 && i + n < nblocks &&
+               treedisk_map(ts, snapshot.inode->root, nlevels, (offset + i + n) >> ts->log_cluster, &next) == 0 &&
+               next == b + n)
+            n += ts->cluster;
+        if (n > nblocks - i)
+            n = nblocks - i;
+
+        if (b == 0)
+            memset(&blocks[i], 0, n * BLOCK_SIZE);
+        else if ((*ts->below->readv)(ts->below, ts->below_ino, b, &blocks[i], n) < 0)
+            return -1;
+        i += n;
     }
     return 0;
 }
 
+/* A block fits inline if all its bytes after the first TREEDISK_INLINE_SIZE
+ * are null.
+ */
+static int treedisk_fits_inline(block_t *block){
+    for (unsigned int i = TREEDISK_INLINE_SIZE; i < BLOCK_SIZE; i++)
+        if (block->bytes[i] != 0)
+            return 0;
+    return 1;
+}
+
 /* Write *block at the given block number 'offset'.
  */
 static int treedisk_write(inode_store_t *this_bs, unsigned int ino, block_no offset, block_t *block){
@@ -231,25 +656,68 @@ static int treedisk_write(inode_store_t *this_bs, unsigned int ino, block_no off
     if (treedisk_get_snapshot(snapshot, ts, ino) < 0)
         return -1;
 
-    /* Figure out how many levels there are in the tree now.
+    /* Store the only block of a file inline if it fits.
      */
-    unsigned int nlevels = 0;
-    if (snapshot->inode->nblocks > 0)
-        while (log_shift_r(snapshot->inode->nblocks - 1, nlevels * log_rpb) != 0) {
-            nlevels++;
+    if (offset == 0 && snapshot->inode->nblocks <= 1 &&
+            (snapshot->inode->nblocks == 0 || snapshot->inode->root == TREEDISK_INLINE) &&
+            treedisk_fits_inline(block)) {
+        block_no inline_blockno;
+        union treedisk_block *inlineblock;
+        char *data = treedisk_get_inline(ts, ino, &inline_blockno, &inlineblock);
+        if (data == NULL)
+            return -1;
+        memcpy(data, block, TREEDISK_INLINE_SIZE);
+        if ((*ts->below->write)(ts->below, ts->below_ino, inline_blockno, (block_t *) inlineblock) < 0)
+            panic("treedisk_write: inline block");
+
+        if (snapshot->inode->root != TREEDISK_INLINE) {
+            snapshot->inode->root = TREEDISK_INLINE;
+            snapshot->inode->nblocks = 1;
+            if ((*ts->below->write)(ts->below, ts->below_ino, snapshot->inode_blockno, (block_t *) snapshot->inodeblock) < 0)
+                panic("treedisk_write: inode block");
         }
+        return 0;
+    }
+
+    /* Fail before changing anything if there may not be enough free FS
+     * blocks, i.e., for the inline data, the new levels of the tree, the
+     * indirect blocks on the path to the block and the block itself.
+     */
+    block_no nblocks_after = (offset >= snapshot->inode->nblocks) ? offset + 1 : snapshot->inode->nblocks;
+    if (nblocks_after == 0 ||
+        !treedisk_has_free(ts, 2 * treedisk_nlevels(treedisk_nclusters(ts, nblocks_after)) + 2))
+        return -1;
+
+    /* Otherwise move inline data to a data block first.  If block 0 is
+     * being overwritten, it is simply allocated below.
+     */
+    if (snapshot->inode->root == TREEDISK_INLINE) {
+        block_no b = 0;
+        if (offset != 0) {
+            block_t data;
+            if (treedisk_read_inline(ts, ino, &data) < 0)
+                return -1;
+            b = treedisk_alloc_block(ts, 0);
+            if ((*ts->below->write)(ts->below, ts->below_ino, b, &data) < 0)
+                panic("treedisk_write: inline data");
+        }
+        snapshot->inode->root = b;
+        dirty_inode = 1;
+    }
+
+    /* Figure out how many levels there are in the tree now.
+     */
+    unsigned int nlevels = treedisk_nlevels(treedisk_nclusters(ts, snapshot->inode->nblocks));
 
     /* Figure out how many levels we need after writing.  Files cannot shrink
      * by writing.
      */
     unsigned int nlevels_after;
     if (offset >= snapshot->inode->nblocks) {
+        treedisk_zero_tail(ts, snapshot->inode, snapshot->inode->nblocks, offset);
         snapshot->inode->nblocks = offset + 1;
         dirty_inode = 1;
-        nlevels_after = 0;
-        while (log_shift_r(offset, nlevels_after * log_rpb) != 0) {
-            nlevels_after++;
-        }
+        nlevels_after = treedisk_nlevels(treedisk_nclusters(ts, offset + 1));
     }
     else {
         nlevels_after = nlevels;
@@ -260,67 +728,71 @@ static int treedisk_write(inode_store_t *this_bs, unsigned int ino, block_no off
     if (snapshot->inode->nblocks == 0) {
         nlevels = nlevels_after;
     } else if (nlevels_after > nlevels) {
-        while (nlevels_after > nlevels) {
-            block_no indir = treedisk_alloc_block(ts, snapshot);
-
-            /* Insert the new indirect block into the inode.
-             */
-            struct treedisk_indirblock tib;
-            memset(&tib, 0, BLOCK_SIZE);
-            tib.refs[0] = snapshot->inode->root;
-            snapshot->inode->root = indir;
-            dirty_inode = 1;
-            if ((*ts->below->write)(ts->below, ts->below_ino, indir, (block_t *) &tib) < 0) {
-                panic("treedisk_write: indirect block");
-            }
-
-            nlevels++;
-        }
+        treedisk_grow(ts, snapshot->inode, nlevels, nlevels_after);
+        nlevels = nlevels_after;
     }
 
     /* If the inode block was updated, write it back now.
      */
     if (dirty_inode)
-        if ((*ts->below->write)(ts->below, ts->below_ino, snapshot->inode_blockno, (block_t *) &snapshot->inodeblock) < 0) {
+        if ((*ts->below->write)(ts->below, ts->below_ino, snapshot->inode_blockno, (block_t *) snapshot->inodeblock) < 0) {
             panic("treedisk_write: inode block");
         }
 
-    /* Find the block by walking the tree, allocating new blocks
+    /* Find the FS block by walking the tree, allocating new FS blocks
      * (and indirect blocks) if necessary.
      */
-    block_no b;
+    block_no b, near = 0, mask = ts->cluster - 1;
+    int new_cluster = 0;
     block_no *parent_no = &snapshot->inode->root;
     block_no parent_off = snapshot->inode_blockno;
-    block_t *parent_block = (block_t *) &snapshot->inodeblock;
+    block_t *parent_block = (block_t *) snapshot->inodeblock;
     for (;;) {
         /* Get or allocate the next block.
          */
         struct treedisk_indirblock tib;
         if ((b = *parent_no) == 0) {
-            b = *parent_no = treedisk_alloc_block(ts, snapshot);
-            if ((*ts->below->write)(ts->below, ts->below_ino, parent_off, parent_block) < 0)
+            b = *parent_no = treedisk_alloc_block(ts, near);
+            if (parent_block == (block_t *) snapshot->inodeblock) {
+                if ((*ts->below->write)(ts->below, ts->below_ino, parent_off, parent_block) < 0)
+                    panic("treedisk_write: parent");
+            }
+            else if (treedisk_write_indir(ts, parent_off, (struct treedisk_indirblock *) parent_block) < 0)
                 panic("treedisk_write: parent");
-            if (nlevels == 0)
+            if (nlevels == 0) {
+                new_cluster = 1;
                 break;
+            }
             memset(&tib, 0, BLOCK_SIZE);
         }
         else {
             if (nlevels == 0)
                 break;
-            if ((*ts->below->read)(ts->below, ts->below_ino, b, (block_t *) &tib) < 0)
+            if (treedisk_read_indir(ts, b, &tib) < 0)
                 panic("treedisk_write");
         }
 
         /* Figure out the index into this block and get the block number.
          */
         nlevels--;
-        unsigned int index = log_shift_r(offset, nlevels * log_rpb) % REFS_PER_BLOCK;
+        unsigned int index = log_shift_r(offset >> ts->log_cluster, nlevels * log_rpb) % REFS_PER_BLOCK;
         parent_no = &tib.refs[index];
         parent_block = (block_t *) &tib;
         parent_off = b;
+
+        /* Allocate next to the previous block of the file, if any */
+        near = (index > 0 && tib.refs[index - 1] != 0) ? tib.refs[index - 1] : b;
     }
 
-    if ((*ts->below->write)(ts->below, ts->below_ino, b, block) < 0)
+    /* The other blocks of a new FS block within the file are holes.
+     */
+    if (new_cluster)
+        for (block_no o = offset & ~mask; o < snapshot->inode->nblocks && o <= (offset | mask); o++)
+            if (o != offset && (*ts->below->write)(ts->below, ts->below_ino, b + (o & mask), &null_block) < 0)
+                panic("treedisk_write: hole");
+
+    bitmap_flush(&ts->bitmap);
+    if ((*ts->below->write)(ts->below, ts->below_ino, b + (offset & mask), block) < 0)
         panic("treedisk_write: data block");
     return 0;
 }
@@ -340,10 +812,71 @@ inode_store_t *treedisk_init(inode_store_t *below, unsigned int below_ino){
     /* Create the inode store state structure.
      */
     struct treedisk_state *ts = malloc(sizeof(struct treedisk_state));
+    if (ts == NULL)
+        panic("treedisk_init: out of memory");
     memset(ts, 0, sizeof(struct treedisk_state));
     ts->below = below;
     ts->below_ino = below_ino;
 
+    /* Pin the superblock, the inode blocks and, if there is enough memory,
+     * the inline blocks.
+     */
+    if ((*below->read)(below, below_ino, 0, (block_t *) &ts->superblock) < 0)
+        panic("treedisk_init: superblock");
+    block_no n_inodeblocks = ts->superblock.superblock.n_inodeblocks;
+
+    /* Figure out the size of an FS block in blocks.
+     */
+    block_no block_size = ts->superblock.superblock.block_size;
+    ts->cluster = (block_size == 0) ? 1 : block_size / BLOCK_SIZE;
+    while ((1U << ts->log_cluster) < ts->cluster)
+        ts->log_cluster++;
+    if ((1U << ts->log_cluster) != ts->cluster || ts->cluster > BITS_PER_BLOCK)
+        panic("treedisk_init: bad FS block size");
+    struct treedisk_superblock *sb = &ts->superblock.superblock;
+    ts->first_cluster = treedisk_nclusters(ts, 1 + n_inodeblocks + sb->n_inlineblocks +
+                                           sb->n_bitmapblocks + sb->n_ibitmapblocks);
+    ts->ninodes = n_inodeblocks * INODES_PER_BLOCK;
+    ts->inodeblocks = malloc(n_inodeblocks * BLOCK_SIZE);
+    if (ts->inodeblocks == NULL)
+        panic("treedisk_init: no memory for the inode blocks");
+    for (block_no i = 0; i < n_inodeblocks; i++)
+        if ((*below->read)(below, below_ino, 1 + i, (block_t *) &ts->inodeblocks[i]) < 0)
+            panic("treedisk_init: inode block");
+    int pin_inline = (sb->n_inlineblocks <= TREEDISK_PIN_NINLINEBLOCKS);
+#ifndef MKFS
+    pin_inline = pin_inline && earth->platform != ARTY;
+#endif
+    if (pin_inline)
+        ts->inlineblocks = malloc(sb->n_inlineblocks * BLOCK_SIZE);
+    if (ts->inlineblocks != NULL) {
+        for (block_no i = 0; i < sb->n_inlineblocks; i++)
+            if ((*below->read)(below, below_ino, 1 + n_inodeblocks + i, (block_t *) &ts->inlineblocks[i]) < 0)
+                panic("treedisk_init: inline block");
+    }
+
+    bitmap_init(&ts->bitmap, below, below_ino, 1 + n_inodeblocks + sb->n_inlineblocks, sb->n_bitmapblocks);
+
+    /* Grow the file system to the size of the inode below, e.g., when the
+     * disk image is copied to a microSD card larger than the image.
+     */
+    int size = (*below->getsize)(below, below_ino);
+    block_no oldsize = sb->nblocks >> ts->log_cluster << ts->log_cluster;
+    block_no newsize = (size < 0) ? 0 : (block_no) size >> ts->log_cluster << ts->log_cluster;
+    if (newsize > oldsize) {
+        printf("treedisk: growing the file system from %u to %u blocks\n", sb->nblocks, size);
+        bitmap_grow(&ts->bitmap, oldsize, newsize, ts->cluster);
+
+        /* The bitmap blocks reach the disk before the superblock, so that
+         * the larger size is never seen without them.
+         */
+        if (below->sync != NULL && (*below->sync)(below) < 0)
+            panic("treedisk_init: bitmap");
+        sb->nblocks = size;
+        if ((*below->write)(below, below_ino, 0, (block_t *) &ts->superblock) < 0)
+            panic("treedisk_init: superblock");
+    }
+
     /* Return a block interface to this inode.
      */
     inode_store_t *this_bs = malloc(sizeof(inode_store_t));
@@ -353,51 +886,110 @@ inode_store_t *treedisk_init(inode_store_t *below, unsigned int below_ino){
     this_bs->setsize = treedisk_setsize;
     this_bs->read = treedisk_read;
     this_bs->write = treedisk_write;
+    this_bs->readv = treedisk_readv;
     return this_bs;
 }
 
+/* Return the inode allocation bitmap of a treedisk in *ib.
+ */
+static int treedisk_ibitmap(struct treedisk_state *ts, struct treedisk_bitmap *ib){
+    struct treedisk_superblock *sb = &ts->superblock.superblock;
+    if (sb->n_ibitmapblocks == 0)
+        return -1;
+    bitmap_init(ib, ts->below, ts->below_ino,
+                1 + sb->n_inodeblocks + sb->n_inlineblocks + sb->n_bitmapblocks, sb->n_ibitmapblocks);
+    return 0;
+}
+
+/* Allocate the free inode with the lowest number.
+ */
+int treedisk_alloc_inode(inode_store_t *this_bs){
+    struct treedisk_state *ts = this_bs->state;
+    struct treedisk_bitmap ib;
+    if (treedisk_ibitmap(ts, &ib) < 0)
+        return -1;
+
+    for (unsigned int ino = 0; ino < ts->ninodes; ino++)
+        if (!bitmap_test(&ib, ino)) {
+            bitmap_set(&ib, ino, 1);
+            bitmap_flush(&ib);
+            return ino;
+        }
+    return -1;
+}
+
+/* Free an inode and all its blocks.
+ */
+int treedisk_free_inode(inode_store_t *this_bs, unsigned int ino){
+    struct treedisk_state *ts = this_bs->state;
+    struct treedisk_bitmap ib;
+    if (treedisk_ibitmap(ts, &ib) < 0 || ino >= ts->ninodes)
+        return -1;
+    if (treedisk_setsize(this_bs, ino, 0) < 0)
+        return -1;
+
+    bitmap_clear(&ib, ino, 1);
+    bitmap_flush(&ib);
+    return 0;
+}
+
 /*************************************************************************
  * The code below is for creating new tree file systems.  This should
  * only be invoked once per underlying inode store.
  ************************************************************************/
 
-/* Create the free list and return the block number of the first
- * block on it.
+/* Create a bitmap in the n_bitmapblocks blocks from block 'start' on, with
+ * the first 'nused' bits and the bits from 'nbits' on set, e.g., for the
+ * blocks in use and beyond the end of the file system.
  */
-block_no setup_freelist(inode_store_t *below, unsigned int below_ino, block_no next_free, block_no nblocks){
-    block_no freelist_data[REFS_PER_BLOCK];
-    block_no freelist_block = 0;
-    unsigned int i;
-
-    while (next_free < nblocks) {
-        freelist_data[0] = freelist_block;
-        freelist_block = next_free++;
-        for (i = 1; i < REFS_PER_BLOCK && next_free < nblocks; i++)
-            freelist_data[i] = next_free++;
+void setup_bitmap(inode_store_t *below, unsigned int below_ino, block_no start,
+                  block_no n_bitmapblocks, block_no nused, block_no nbits){
+    union treedisk_block bitmapblock;
 
-        for (; i < REFS_PER_BLOCK; i++)
-            freelist_data[i] = 0;
+    for (block_no i = 0; i < n_bitmapblocks; i++) {
+        memset(&bitmapblock, 0, BLOCK_SIZE);
+        for (block_no j = 0; j < BITS_PER_BLOCK; j++) {
+            block_no b = i * BITS_PER_BLOCK + j;
+            if (b < nused || b >= nbits)
+                BITMAP_SET(bitmapblock.bitmapblock.bits, j);
+        }
 
-        if ((*below->write)(below, below_ino, freelist_block, (block_t *) freelist_data) < 0)
-            panic("treedisk_setup_freelist");
+        if ((*below->write)(below, below_ino, start + i, (block_t *) &bitmapblock) < 0)
+            panic("treedisk_setup_bitmap");
     }
-    return freelist_block;
 }
 
 /* Create a new file system on the specified inode of the inode store below.
  */
-int treedisk_create(inode_store_t *below, unsigned int below_ino, unsigned int ninodes){
+int treedisk_create(inode_store_t *below, unsigned int below_ino, unsigned int ninodes,
+                    unsigned int block_size){
     if (sizeof(union treedisk_block) != BLOCK_SIZE)
         panic("treedisk_create: block has wrong size");
+    if (block_size < BLOCK_SIZE || block_size % BLOCK_SIZE != 0 ||
+            (block_size & (block_size - 1)) != 0 || block_size / BLOCK_SIZE > BITS_PER_BLOCK) {
+        printf("treedisk_create: bad FS block size %u\n", block_size);
+        return -1;
+    }
+    unsigned int cluster = block_size / BLOCK_SIZE;
+    if (ninodes > TREEDISK_MAX_NINODES) {
+        printf("treedisk_create: %u inodes, more than %u\n", ninodes, (unsigned int) TREEDISK_MAX_NINODES);
+        return -1;
+    }
 
-    /* Compute the number of inode blocks needed to store the inodes.
+    /* Compute the number of inode blocks needed to store the inodes,
+     * and of blocks of the inline table and inode allocation bitmap.
      */
     unsigned int n_inodeblocks = (ninodes + INODES_PER_BLOCK - 1) / INODES_PER_BLOCK;
+    unsigned int n_inlineblocks = (n_inodeblocks * INODES_PER_BLOCK + INLINES_PER_BLOCK - 1) / INLINES_PER_BLOCK;
+    unsigned int n_ibitmapblocks = (n_inodeblocks * INODES_PER_BLOCK + BITS_PER_BLOCK - 1) / BITS_PER_BLOCK;
 
     /* Get the size of the underlying disk and see if it's large enough.
      */
     unsigned int nblocks = (*below->getsize)(below, below_ino);
-    if (nblocks < n_inodeblocks + 2) {
+    unsigned int n_bitmapblocks = (nblocks + BITS_PER_BLOCK - 1) / BITS_PER_BLOCK;
+    unsigned int nmeta = 1 + n_inodeblocks + n_inlineblocks + n_bitmapblocks + n_ibitmapblocks;
+    unsigned int nused = (nmeta + cluster - 1) / cluster * cluster;
+    if (nblocks < nused + cluster) {
         printf("treedisk_create: too few blocks\n");
         return -1;
     }
@@ -414,8 +1006,16 @@ int treedisk_create(inode_store_t *below, unsigned int below_ino, unsigned int n
         union treedisk_block superblock;
         memset(&superblock, 0, BLOCK_SIZE);
         superblock.superblock.n_inodeblocks = n_inodeblocks;
-        superblock.superblock.free_list =
-            setup_freelist(below, below_ino, n_inodeblocks + 1, nblocks);
+        superblock.superblock.n_bitmapblocks = n_bitmapblocks;
+        superblock.superblock.nblocks = nblocks;
+        superblock.superblock.block_size = block_size;
+        superblock.superblock.n_ibitmapblocks = n_ibitmapblocks;
+        superblock.superblock.n_inlineblocks = n_inlineblocks;
+        unsigned int start = 1 + n_inodeblocks + n_inlineblocks;
+        setup_bitmap(below, below_ino, start, n_bitmapblocks,
+                     nused, nblocks / cluster * cluster);
+        setup_bitmap(below, below_ino, start + n_bitmapblocks, n_ibitmapblocks,
+                     0, n_inodeblocks * INODES_PER_BLOCK);
         if ((*below->write)(below, below_ino, 0, (block_t *) &superblock) < 0)
             return -1;
 
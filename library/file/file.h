@@ -9,8 +9,8 @@
  * a virtualized inode store.  Each virtualized file is identified by a
  * so-called "inode number", which indexes into an array of inodes.
  *
- * The superblock maintains the number of inode blocks and a pointer
- * to the free list structure.
+ * The superblock maintains the number of inode blocks, the number of
+ * blocks of the free space bitmap and the size of the file system.
  *
  * An inode block is filled with INODES_PER_BLOCK inodes.  Data in the
  * inode is stored in a complete tree, with the branching vector determined
@@ -25,29 +25,74 @@
  * exist both for data and indirect blocks.  Reading from a hole returns
  * null bytes.
  *
- * The free list is a linked list of blocks.  Each block is filled with
- * block indices, the first of which is either 0 to indicate the end of
- * the list, or otherwise a pointer to the next block on the list.  The
- * remaining slots point to free blocks, or 0 if the slot is empty.
+ * A file of one block whose bytes after the first TREEDISK_INLINE_SIZE
+ * are all null is stored inline: its root is TREEDISK_INLINE and the data
+ * is in its slot of the inline table, which follows the inode blocks and
+ * has a slot for every inode.  Small text files and directories of one
+ * block with up to 6 entries (see dir.h) are stored this way, and
+ * the inline blocks stay resident where memory allows, so reading them
+ * needs no device access.  Writing data that does not fit moves it to a
+ * data block.  The inline table is kept apart from the inodes so that the
+ * inode blocks stay small enough to be resident on every board.
+ *
+ * The free space bitmap follows the inline table and has one bit for
+ * every block of the file system, set if the block is in use.  The
+ * superblock, inode, inline and bitmap blocks are always in use.  A file
+ * system made by mkfs grows when it is opened on a larger inode store,
+ * e.g., a microSD card, up to the size of the store.  The bitmap blocks
+ * for the BITS_PER_BLOCK blocks from block i * BITS_PER_BLOCK on are then
+ * the n_bitmapblocks blocks after the inline table if i < n_bitmapblocks,
+ * or else block i * BITS_PER_BLOCK itself, which is thus in use.
+ *
+ * The inode allocation bitmap follows the free space bitmap and has one
+ * bit for every inode, set if the inode is allocated.  A file system
+ * without one (n_ibitmapblocks is 0) does not keep track of free inodes.
+ *
+ * Blocks are BLOCK_SIZE bytes, the size of a disk sector, but the file
+ * system allocates space in FS blocks of block_size bytes, chosen by mkfs
+ * and kept in the superblock.  An FS block is a run of block_size /
+ * BLOCK_SIZE blocks aligned to its size, and all its bits in the bitmap
+ * are set or cleared together.  The tree of a file indexes its FS blocks,
+ * so a leaf is the number of the first block of an FS block and block
+ * 'offset' of a file is block offset % (block_size / BLOCK_SIZE) of the
+ * FS block it is in.  An indirect block takes a whole FS block.  The
+ * blocks of an FS block beyond the end of the file may hold stale data;
+ * they are filled with null bytes when the file grows over them.
  */
 #pragma once
 #include "inode.h"
 
 #define REFS_PER_BLOCK    (BLOCK_SIZE / sizeof(block_no))
 #define INODES_PER_BLOCK  (BLOCK_SIZE / sizeof(struct treedisk_inode))
+#define INLINES_PER_BLOCK (BLOCK_SIZE / TREEDISK_INLINE_SIZE)
+#define BITS_PER_BLOCK    (BLOCK_SIZE * 8)
+
+#define TREEDISK_INLINE_SIZE  256
+#define TREEDISK_INLINE       ((block_no) -1)	/* root of an inline file */
+
+/* The inode blocks stay resident in the heap of the file server, which
+ * has MAX_HEAP_NPAGES pages, so a treedisk has at most 16 inode blocks.
+ * The inline table stays resident only if it has at most 64 blocks.
+ */
+#define TREEDISK_MAX_NINODES        (16 * INODES_PER_BLOCK)
+#define TREEDISK_PIN_NINLINEBLOCKS  64
 
 /* Contents of the "superblock".  There is only one of these.
  */
 struct treedisk_superblock {
     block_no n_inodeblocks;		/* # blocks with inodes */
-    block_no free_list;			/* pointer to first block on free list */
+    block_no n_bitmapblocks;		/* # blocks of the free space bitmap */
+    block_no nblocks;			/* # blocks in the file system */
+    block_no block_size;		/* bytes per FS block, 0 if BLOCK_SIZE */
+    block_no n_ibitmapblocks;		/* # blocks of the inode allocation bitmap */
+    block_no n_inlineblocks;		/* # blocks of the inline table */
 };
 
 /* An inode describes a file (= virtual inode store).  "nblocks" contains
  * the number of blocks in the file, while "root" is the top most block in
- * the tree of blocks.  Note that initially "all files exist" but are of
- * length 0.  It is intended that keeping track which files are free or
- * not is maintained elsewhere.
+ * the tree of blocks, or TREEDISK_INLINE if the data is in the inline table.
+ * Note that initially "all files exist" but are of length 0.  Which files
+ * are free or not is kept in the inode allocation bitmap, if any.
  */
 struct treedisk_inode {
     block_no root;			/* block number of root node */
@@ -60,14 +105,46 @@ struct treedisk_inodeblock {
     struct treedisk_inode inodes[INODES_PER_BLOCK];
 };
 
-/* A freelist block is filled with references to other blocks, the first
- * one of which is the next freelist block (0 = end-of-list). Remember that
- * the freelist acts as a stack (freelist blocks are added FILO).
+/* An inline block holds the data of INLINES_PER_BLOCK inline files; slot
+ * i of inline block j is for inode j * INLINES_PER_BLOCK + i.
  */
-struct treedisk_freelistblock {
-    block_no refs[REFS_PER_BLOCK];
+struct treedisk_inlineblock {
+    char data[INLINES_PER_BLOCK][TREEDISK_INLINE_SIZE];
 };
 
+/* A bitmap block holds the bits of BITS_PER_BLOCK consecutive blocks;
+ * bit (b % 8) of bits[b / 8] is for block b.
+ */
+struct treedisk_bitmapblock {
+    unsigned char bits[BLOCK_SIZE];
+};
+
+/* A bitmap of an open file system, shared by treedisk and extentdisk.
+ * Only the bitmap block in use is kept in memory, so that the bitmap of a
+ * large microSD card does not have to fit in the memory of the file server.
+ * It is written back when another bitmap block is needed or by
+ * bitmap_flush().
+ */
+struct treedisk_bitmap {
+    inode_store_t *below;			/* inode store below */
+    unsigned int below_ino;			/* inode number in the store below */
+    block_no start;				/* block number of bitmap block 0 */
+    block_no n_bitmapblocks;			/* # bitmap blocks from 'start' on */
+    block_no index;				/* bitmap block in 'buf', -1 if none */
+    int dirty;					/* 'buf' not written yet */
+    struct treedisk_bitmapblock buf;
+};
+
+void bitmap_init(struct treedisk_bitmap *bm, inode_store_t *below, unsigned int below_ino,
+                 block_no start, block_no n_bitmapblocks);
+int bitmap_test(struct treedisk_bitmap *bm, block_no b);
+void bitmap_set(struct treedisk_bitmap *bm, block_no b, block_no n);
+void bitmap_clear(struct treedisk_bitmap *bm, block_no b, block_no n);
+void bitmap_flush(struct treedisk_bitmap *bm);
+void bitmap_grow(struct treedisk_bitmap *bm, block_no oldsize, block_no newsize, block_no cluster);
+void setup_bitmap(inode_store_t *below, unsigned int below_ino, block_no start,
+                  block_no n_bitmapblocks, block_no nused, block_no nbits);
+
 /* An indirect block is an internal node in the tree rooted at an inode.
  */
 struct treedisk_indirblock {
@@ -81,6 +158,7 @@ union treedisk_block {
     block_t datablock;
     struct treedisk_superblock superblock;
     struct treedisk_inodeblock inodeblock;
-    struct treedisk_freelistblock freelistblock;
+    struct treedisk_inlineblock inlineblock;
+    struct treedisk_bitmapblock bitmapblock;
     struct treedisk_indirblock indirblock;
 };
@@ -28,6 +28,17 @@
  *          write *block to the block at the given inode number and offset
  *          returns 0
  *
+ *      int readv(inode_store_t *this_bs, unsigned int ino, block_no offset, block_t *blocks, block_no nblocks)
+ *          read nblocks consecutive blocks from the given offset on into blocks[],
+ *          in as few requests to the layer below as possible
+ *          returns 0
+ *
+ *      int sync(inode_store_t *this_bs)
+ *          write the blocks cached by this layer to the layer below, e.g., so
+ *          that the next writes reach the disk after them; NULL if the layer
+ *          writes through
+ *          returns 0
+ *
  * All these return -1 upon error (typically after printing the
  * reason for the error).
  *
@@ -45,11 +56,34 @@ typedef struct inode_store {
     int (*setsize)(struct inode_store *this_bs, unsigned int ino, block_no newsize);
     int (*read)(struct inode_store *this_bs, unsigned int ino, block_no offset, block_t *block);
     int (*write)(struct inode_store *this_bs, unsigned int ino, block_no offset, block_t *block);
+    int (*readv)(struct inode_store *this_bs, unsigned int ino, block_no offset, block_t *blocks, block_no nblocks);
+    int (*sync)(struct inode_store *this_bs);
     void *state;
 } inode_store_t;
 
 typedef inode_store_t *inode_intf;    /* inode store interface */
 
 inode_intf fs_disk_init();
+
+/* Number of blocks cached by a cachedisk, see cachedisk.c */
+#ifndef CACHEDISK_NBLOCKS
+#define CACHEDISK_NBLOCKS       32
+#endif
+#define CACHEDISK_NBLOCKS_ARTY  4
+
+struct cachedisk_stats {
+    unsigned int hits, misses, evictions, writebacks;
+};
+
+inode_intf cachedisk_init(inode_intf below, int nblocks);
+int cachedisk_flush(inode_intf cache);
+void cachedisk_stats(inode_intf cache, struct cachedisk_stats *stats);
 inode_intf treedisk_init(inode_intf below, unsigned int below_ino);
-int treedisk_create(inode_intf below, unsigned int below_ino, unsigned int ninodes);
\ No newline at end of file
+int treedisk_create(inode_intf below, unsigned int below_ino, unsigned int ninodes, unsigned int block_size);
+int treedisk_alloc_inode(inode_intf this_bs);
+int treedisk_free_inode(inode_intf this_bs, unsigned int ino);
+inode_intf extentdisk_init(inode_intf below, unsigned int below_ino);
+int extentdisk_create(inode_intf below, unsigned int below_ino, unsigned int ninodes, unsigned int block_size);
+inode_intf logdisk_init(inode_intf below, unsigned int below_ino);
+int logdisk_create(inode_intf below, unsigned int below_ino, unsigned int ninodes);
+int logdisk_checkpoint(inode_intf this_bs);
\ No newline at end of file
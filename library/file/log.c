@@ -0,0 +1,623 @@
+/* Description: a log-structured inode store
+ * A logdisk implements the same interface as a treedisk (see file.c):
+ *
+ *      int logdisk_create(inode_store_t *below, unsigned int below_ino, unsigned int ninodes)
+ *          creates a logdisk file system within inode below_ino of below
+ *
+ *      inode_store_t *logdisk_init(inode_store_t *below, unsigned int below_ino)
+ *          opens the logdisk within inode below_ino of below, or returns
+ *          NULL if there is no logdisk
+ *
+ *      int logdisk_checkpoint(inode_store_t *this_bs)
+ *          appends the dirty map blocks and inodes to the log and writes a
+ *          checkpoint; what is written after the last checkpoint is lost
+ *          if the system stops
+ *
+ * Writes never update a block in place but append it to the log, so the
+ * layer below sees writes at consecutive block numbers.  The map blocks
+ * and inodes changed by writes stay in a small cache and are only
+ * appended when evicted or at a checkpoint, so many writes to a file
+ * share one copy of its metadata.  Since blocks are only written in order,
+ * a logdisk should be stacked on the disk directly and not on a cachedisk,
+ * so that the log reaches the disk before the checkpoint pointing to it.
+ *
+ * A segment becomes free once it has no live block and a checkpoint has
+ * been written, since the previous checkpoint may still point into it.
+ * When fewer than LOGDISK_MIN_FREE segments are free, the cleaner appends
+ * the live blocks of the segment with the fewest of them to the log again
+ * and writes a checkpoint, which frees this segment.  A segment more than
+ * 3/4 live is not worth cleaning.  An operation that appends to the log
+ * fails if it could leave no room to write back the metadata cache, even
+ * after cleaning, i.e., the log is full.  Writes also keep room for
+ * shrinking the largest file, so that files can still be truncated to
+ * free a full log.  The layout of the file system is described in the
+ * file "log.h".
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+
+#ifdef MKFS
+#include <stdio.h>
+#else
+#include "egos.h"
+#endif
+
+#define LOGDISK_MIN_FREE    3
+#define LOGDISK_WRITE_NBLOCKS   5                           /* a block and two evicted entries */
+#define LOGDISK_SHRINK_NBLOCKS  (2 * (LOGDISK_NMAPS + 1))   /* every map block and the inode */
+#define LOGDISK_NMETA       16
+#define LOGDISK_NMETA_ARTY  4
+#define LOGDISK_INODE       -1          /* index of an inode in the metadata cache */
+
+/* A cached inode (index LOGDISK_INODE) or map block 'index' of inode 'ino'.
+ * A pinned entry is in use and cannot be evicted.
+ */
+struct logdisk_meta {
+    int valid, dirty, pinned;
+    unsigned int ino;
+    int index;
+    unsigned int last_use;
+    union logdisk_block block;
+};
+
+struct logdisk_state {
+    inode_store_t *below;                       /* inode store below */
+    unsigned int below_ino;                     /* inode number in the store below */
+    struct logdisk_superblock sb;
+    block_no *imap;                             /* block number of every inode */
+    unsigned short *usage;                      /* # live blocks of every segment */
+    char *reusable;                             /* segments free at the last checkpoint */
+    block_no seq;                               /* seq of the last checkpoint */
+    block_no head_segment, head_offset;         /* where the log continues */
+    int cleaning;
+    int nmeta;
+    unsigned int clock;                         /* incremented at every metadata access */
+    struct logdisk_meta *meta;
+};
+
+static void panic(const char *s) {
+#ifdef MKFS
+    fprintf(stderr, "%s", s);
+    exit(1);
+#else
+    FATAL(s);
+#endif
+}
+
+static int logdisk_segment(struct logdisk_state *ls, block_no b) {
+    return (b - ls->sb.first_segment) / LOGDISK_SEGMENT_NBLOCKS;
+}
+
+/* Block b is not live any more.
+ */
+static void logdisk_release(struct logdisk_state *ls, block_no b) {
+    if (b != 0)
+        ls->usage[logdisk_segment(ls, b)]--;
+}
+
+/* Append *block to the log and return its block number.
+ */
+static block_no logdisk_append(struct logdisk_state *ls, block_t *block) {
+    if (ls->head_offset == LOGDISK_SEGMENT_NBLOCKS) {
+        block_no s;
+        for (s = 0; s < ls->sb.nsegments; s++)
+            if (ls->reusable[s] && ls->usage[s] == 0)
+                break;
+        if (s == ls->sb.nsegments)
+            panic("logdisk_append: the log is full\n");
+        ls->reusable[s] = 0;
+        ls->head_segment = s;
+        ls->head_offset = 0;
+    }
+
+    block_no b = ls->sb.first_segment + ls->head_segment * LOGDISK_SEGMENT_NBLOCKS + ls->head_offset++;
+    if ((*ls->below->write)(ls->below, ls->below_ino, b, block) < 0)
+        panic("logdisk_append");
+    ls->usage[ls->head_segment]++;
+    return b;
+}
+
+static struct logdisk_meta *logdisk_meta_find(struct logdisk_state *ls, unsigned int ino, int index) {
+    for (int i = 0; i < ls->nmeta; i++) {
+        struct logdisk_meta *m = &ls->meta[i];
+        if (m->valid && m->ino == ino && m->index == index)
+            return m;
+    }
+    return NULL;
+}
+
+static struct logdisk_meta *logdisk_meta_get(struct logdisk_state *ls, unsigned int ino, int index);
+
+/* Append a dirty inode or map block to the log and point the imap or its
+ * inode to the new copy.  If the inode of a map block is not cached, it is
+ * updated and appended right away instead of taking another entry, whose
+ * eviction could need yet another one.
+ */
+static void logdisk_meta_writeback(struct logdisk_state *ls, struct logdisk_meta *m) {
+    m->dirty = 0;
+    block_no b = logdisk_append(ls, &m->block.datablock);
+    if (m->index == LOGDISK_INODE) {
+        logdisk_release(ls, ls->imap[m->ino]);
+        ls->imap[m->ino] = b;
+        return;
+    }
+
+    struct logdisk_meta *im = logdisk_meta_find(ls, m->ino, LOGDISK_INODE);
+    if (im != NULL) {
+        logdisk_release(ls, im->block.inode.maps[m->index]);
+        im->block.inode.maps[m->index] = b;
+        im->dirty = 1;
+        return;
+    }
+
+    union logdisk_block inode;
+    if (ls->imap[m->ino] == 0)
+        memset(&inode, 0, BLOCK_SIZE);
+    else if ((*ls->below->read)(ls->below, ls->below_ino, ls->imap[m->ino], &inode.datablock) < 0)
+        panic("logdisk_meta_writeback");
+    logdisk_release(ls, inode.inode.maps[m->index]);
+    inode.inode.maps[m->index] = b;
+    b = logdisk_append(ls, &inode.datablock);
+    logdisk_release(ls, ls->imap[m->ino]);
+    ls->imap[m->ino] = b;
+}
+
+/* Find a free entry or evict the least recently used one, preferably a
+ * clean one.
+ */
+static struct logdisk_meta *logdisk_meta_victim(struct logdisk_state *ls) {
+    struct logdisk_meta *victim = NULL;
+    for (int i = 0; i < ls->nmeta; i++) {
+        struct logdisk_meta *m = &ls->meta[i];
+        if (!m->valid)
+            return m;
+        if (m->pinned)
+            continue;
+        if (victim == NULL || m->dirty < victim->dirty ||
+            (m->dirty == victim->dirty && m->last_use < victim->last_use))
+            victim = m;
+    }
+    if (victim == NULL)
+        panic("logdisk_meta_victim: all entries are pinned\n");
+
+    if (victim->dirty)
+        logdisk_meta_writeback(ls, victim);
+    victim->valid = 0;
+    return victim;
+}
+
+/* Get inode 'ino' (index LOGDISK_INODE) or its map block 'index' into the
+ * metadata cache.  A block not written yet starts out as null bytes.
+ */
+static struct logdisk_meta *logdisk_meta_get(struct logdisk_state *ls, unsigned int ino, int index) {
+    struct logdisk_meta *m = logdisk_meta_find(ls, ino, index);
+    if (m != NULL) {
+        m->last_use = ++ls->clock;
+        return m;
+    }
+
+    /* Evicting the victim may write back a map block and thus move the
+     * inode, so the block number is only looked up afterwards.
+     */
+    block_no b;
+    if (index == LOGDISK_INODE) {
+        m = logdisk_meta_victim(ls);
+        b = ls->imap[ino];
+    } else {
+        struct logdisk_meta *im = logdisk_meta_get(ls, ino, LOGDISK_INODE);
+        im->pinned++;
+        m = logdisk_meta_victim(ls);
+        b = im->block.inode.maps[index];
+        im->pinned--;
+    }
+    if (b == 0)
+        memset(&m->block, 0, BLOCK_SIZE);
+    else if ((*ls->below->read)(ls->below, ls->below_ino, b, &m->block.datablock) < 0)
+        panic("logdisk_meta_get");
+    m->valid = 1;
+    m->dirty = m->pinned = 0;
+    m->ino = ino;
+    m->index = index;
+    m->last_use = ++ls->clock;
+    return m;
+}
+
+/* Block number of block 'offset' of inode 'ino', 0 for a hole.
+ */
+static block_no logdisk_map(struct logdisk_state *ls, unsigned int ino, block_no offset) {
+    struct logdisk_meta *m = logdisk_meta_get(ls, ino, offset / LOGDISK_REFS_PER_BLOCK);
+    return m->block.map.refs[offset % LOGDISK_REFS_PER_BLOCK];
+}
+
+static block_no logdisk_checksum(struct logdisk_state *ls) {
+    block_no sum = 0;
+    unsigned char *p = (void *) ls->imap;
+    for (unsigned int i = 0; i < ls->sb.n_imapblocks * BLOCK_SIZE; i++)
+        sum = sum * 31 + p[i];
+    p = (void *) ls->usage;
+    for (unsigned int i = 0; i < ls->sb.n_usageblocks * BLOCK_SIZE; i++)
+        sum = sum * 31 + p[i];
+    return sum;
+}
+
+int logdisk_checkpoint(inode_store_t *this_bs) {
+    struct logdisk_state *ls = this_bs->state;
+
+    /* Map blocks first, since writing them back dirties their inodes.
+     */
+    for (;;) {
+        struct logdisk_meta *dirty = NULL;
+        for (int i = 0; i < ls->nmeta; i++)
+            if (ls->meta[i].valid && ls->meta[i].dirty &&
+                (dirty == NULL || ls->meta[i].index > dirty->index))
+                dirty = &ls->meta[i];
+        if (dirty == NULL)
+            break;
+        logdisk_meta_writeback(ls, dirty);
+    }
+
+    /* Write the imap and usage table, and then the header.
+     */
+    ls->seq++;
+    block_no region = 1 + (ls->seq % 2) * (1 + ls->sb.n_imapblocks + ls->sb.n_usageblocks);
+    for (block_no i = 0; i < ls->sb.n_imapblocks; i++)
+        if ((*ls->below->write)(ls->below, ls->below_ino, region + 1 + i,
+                                (block_t *) ((char *) ls->imap + i * BLOCK_SIZE)) < 0)
+            return -1;
+    for (block_no i = 0; i < ls->sb.n_usageblocks; i++)
+        if ((*ls->below->write)(ls->below, ls->below_ino, region + 1 + ls->sb.n_imapblocks + i,
+                                (block_t *) ((char *) ls->usage + i * BLOCK_SIZE)) < 0)
+            return -1;
+
+    union logdisk_block header;
+    memset(&header, 0, BLOCK_SIZE);
+    header.header.magic = LOGDISK_MAGIC;
+    header.header.seq = ls->seq;
+    header.header.head_segment = ls->head_segment;
+    header.header.head_offset = ls->head_offset;
+    header.header.checksum = logdisk_checksum(ls);
+    if ((*ls->below->write)(ls->below, ls->below_ino, region, &header.datablock) < 0)
+        return -1;
+
+    for (block_no s = 0; s < ls->sb.nsegments; s++)
+        ls->reusable[s] = (ls->usage[s] == 0 && s != ls->head_segment);
+    return 0;
+}
+
+static int logdisk_nfree(struct logdisk_state *ls) {
+    int nfree = 0;
+    for (block_no s = 0; s < ls->sb.nsegments; s++)
+        if (ls->reusable[s] && ls->usage[s] == 0)
+            nfree++;
+    return nfree;
+}
+
+/* Return whether n blocks can be appended to the log and the metadata
+ * cache still be written back after them.  Writing back a dirty entry
+ * appends at most two blocks, the entry and its inode.
+ */
+static int logdisk_has_room(struct logdisk_state *ls, block_no n) {
+    block_no room = logdisk_nfree(ls) * LOGDISK_SEGMENT_NBLOCKS + LOGDISK_SEGMENT_NBLOCKS - ls->head_offset;
+    return room >= n + 2 * ls->nmeta;
+}
+
+/* Move the live blocks of the segment with the fewest of them to the end
+ * of the log, by walking all the inodes, and write a checkpoint.  There
+ * must be room for the blocks moved and for the map blocks and inodes
+ * pointing to them, which become dirty.
+ */
+static int logdisk_clean(inode_store_t *this_bs) {
+    struct logdisk_state *ls = this_bs->state;
+    block_no victim = ls->sb.nsegments;
+    for (block_no s = 0; s < ls->sb.nsegments; s++)
+        if (s != ls->head_segment && ls->usage[s] > 0 &&
+            (victim == ls->sb.nsegments || ls->usage[s] < ls->usage[victim]))
+            victim = s;
+    if (victim == ls->sb.nsegments || ls->usage[victim] > LOGDISK_SEGMENT_NBLOCKS * 3 / 4 ||
+        !logdisk_has_room(ls, 3 * ls->usage[victim]))
+        return -1;
+
+    ls->cleaning = 1;
+    for (unsigned int ino = 0; ino < ls->sb.ninodes; ino++) {
+        if (ls->imap[ino] == 0 && logdisk_meta_find(ls, ino, LOGDISK_INODE) == NULL)
+            continue;
+        struct logdisk_meta *im = logdisk_meta_get(ls, ino, LOGDISK_INODE);
+        im->pinned++;
+        if (ls->imap[ino] != 0 && logdisk_segment(ls, ls->imap[ino]) == victim)
+            im->dirty = 1;
+
+        block_no nmaps = (im->block.inode.nblocks + LOGDISK_REFS_PER_BLOCK - 1) / LOGDISK_REFS_PER_BLOCK;
+        for (block_no k = 0; k < nmaps; k++) {
+            block_no mb = im->block.inode.maps[k];
+            if (mb == 0 && logdisk_meta_find(ls, ino, k) == NULL)
+                continue;
+            struct logdisk_meta *m = logdisk_meta_get(ls, ino, k);
+            m->pinned++;
+            if (mb != 0 && logdisk_segment(ls, mb) == victim)
+                m->dirty = 1;
+
+            for (block_no i = 0; i < LOGDISK_REFS_PER_BLOCK; i++) {
+                block_no b = m->block.map.refs[i];
+                if (b == 0 || logdisk_segment(ls, b) != victim)
+                    continue;
+                block_t data;
+                if ((*ls->below->read)(ls->below, ls->below_ino, b, &data) < 0)
+                    panic("logdisk_clean");
+                m->block.map.refs[i] = logdisk_append(ls, &data);
+                logdisk_release(ls, b);
+                m->dirty = 1;
+            }
+            m->pinned--;
+        }
+        im->pinned--;
+    }
+
+    int r = logdisk_checkpoint(this_bs);
+    ls->cleaning = 0;
+    return r;
+}
+
+/* Make sure that there are enough free segments before an operation
+ * appends up to n blocks to the log.  Segments emptied since the last
+ * checkpoint are freed by a checkpoint first.  Cleaning stops when it
+ * does not free a segment any more.  Return -1 if the log is full, i.e.,
+ * there is no room for the n blocks even after cleaning.
+ */
+static int logdisk_reserve(inode_store_t *this_bs, block_no n) {
+    struct logdisk_state *ls = this_bs->state;
+    if (ls->cleaning || (logdisk_nfree(ls) >= LOGDISK_MIN_FREE && logdisk_has_room(ls, n)))
+        return 0;
+
+    if (logdisk_checkpoint(this_bs) < 0)
+        panic("logdisk_reserve: checkpoint");
+    for (;;) {
+        int nfree = logdisk_nfree(ls);
+        if ((nfree >= LOGDISK_MIN_FREE && logdisk_has_room(ls, n)) ||
+            logdisk_clean(this_bs) < 0 || logdisk_nfree(ls) <= nfree)
+            break;
+    }
+    return logdisk_has_room(ls, n) ? 0 : -1;
+}
+
+static int logdisk_getsize(inode_store_t *this_bs, unsigned int ino) {
+    struct logdisk_state *ls = this_bs->state;
+    if (ino >= ls->sb.ninodes)
+        return -1;
+    return logdisk_meta_get(ls, ino, LOGDISK_INODE)->block.inode.nblocks;
+}
+
+/* Free the blocks after the first 'nblocks' blocks, or grow the file with
+ * holes, and return the old size.
+ */
+static int logdisk_setsize(inode_store_t *this_bs, unsigned int ino, block_no nblocks) {
+    struct logdisk_state *ls = this_bs->state;
+    if (ino >= ls->sb.ninodes || nblocks > LOGDISK_MAX_NBLOCKS)
+        return -1;
+
+    /* Shrinking changes every map block from the new end of the file on,
+     * while growing keeps room for shrinking like a write.
+     */
+    block_no oldsize = logdisk_getsize(this_bs, ino), n = LOGDISK_SHRINK_NBLOCKS;
+    if (oldsize > nblocks)
+        n = 2 * ((oldsize + LOGDISK_REFS_PER_BLOCK - 1) / LOGDISK_REFS_PER_BLOCK -
+                 nblocks / LOGDISK_REFS_PER_BLOCK + 1);
+    if (logdisk_reserve(this_bs, n) < 0)
+        return -1;
+
+    struct logdisk_meta *im = logdisk_meta_get(ls, ino, LOGDISK_INODE);
+    im->pinned++;
+    for (block_no k = nblocks / LOGDISK_REFS_PER_BLOCK; k * LOGDISK_REFS_PER_BLOCK < oldsize; k++) {
+        block_no first = (k * LOGDISK_REFS_PER_BLOCK < nblocks) ? nblocks - k * LOGDISK_REFS_PER_BLOCK : 0;
+        if (im->block.inode.maps[k] == 0 && logdisk_meta_find(ls, ino, k) == NULL)
+            continue;
+
+        struct logdisk_meta *m = logdisk_meta_get(ls, ino, k);
+        for (block_no i = first; i < LOGDISK_REFS_PER_BLOCK; i++) {
+            logdisk_release(ls, m->block.map.refs[i]);
+            m->block.map.refs[i] = 0;
+        }
+        m->dirty = 1;
+
+        /* A map block without any block left is dropped.
+         */
+        if (first == 0) {
+            logdisk_release(ls, im->block.inode.maps[k]);
+            im->block.inode.maps[k] = 0;
+            m->valid = 0;
+        }
+    }
+
+    im->block.inode.nblocks = nblocks;
+    im->dirty = 1;
+    im->pinned--;
+    return oldsize;
+}
+
+static int logdisk_read(inode_store_t *this_bs, unsigned int ino, block_no offset, block_t *block) {
+    struct logdisk_state *ls = this_bs->state;
+    if (ino >= ls->sb.ninodes || offset >= logdisk_getsize(this_bs, ino))
+        return -1;
+
+    block_no b = logdisk_map(ls, ino, offset);
+    if (b == 0) {
+        memset(block, 0, BLOCK_SIZE);
+        return 0;
+    }
+    return (*ls->below->read)(ls->below, ls->below_ino, b, block);
+}
+
+/* Blocks of a file written together are next to each other in the log,
+ * so a run of them is read from below in one request.
+ */
+static int logdisk_readv(inode_store_t *this_bs, unsigned int ino, block_no offset,
+                         block_t *blocks, block_no nblocks) {
+    struct logdisk_state *ls = this_bs->state;
+    if (ino >= ls->sb.ninodes || offset + nblocks > logdisk_getsize(this_bs, ino))
+        return -1;
+
+    for (block_no i = 0; i < nblocks; ) {
+        block_no b = logdisk_map(ls, ino, offset + i);
+        if (b == 0) {
+            memset(&blocks[i++], 0, BLOCK_SIZE);
+            continue;
+        }
+
+        block_no n = 1;
+        while (i + n < nblocks && logdisk_map(ls, ino, offset + i + n) == b + n)
+            n++;
+        if ((*ls->below->readv)(ls->below, ls->below_ino, b, &blocks[i], n) < 0)
+            return -1;
+        i += n;
+    }
+    return 0;
+}
+
+static int logdisk_write(inode_store_t *this_bs, unsigned int ino, block_no offset, block_t *block) {
+    struct logdisk_state *ls = this_bs->state;
+    if (ino >= ls->sb.ninodes || offset >= LOGDISK_MAX_NBLOCKS)
+        return -1;
+
+    if (logdisk_reserve(this_bs, LOGDISK_WRITE_NBLOCKS + LOGDISK_SHRINK_NBLOCKS) < 0)
+        return -1;
+    block_no b = logdisk_append(ls, block);
+
+    struct logdisk_meta *im = logdisk_meta_get(ls, ino, LOGDISK_INODE);
+    im->pinned++;
+    if (offset >= im->block.inode.nblocks) {
+        im->block.inode.nblocks = offset + 1;
+        im->dirty = 1;
+    }
+
+    struct logdisk_meta *m = logdisk_meta_get(ls, ino, offset / LOGDISK_REFS_PER_BLOCK);
+    block_no *ref = &m->block.map.refs[offset % LOGDISK_REFS_PER_BLOCK];
+    logdisk_release(ls, *ref);
+    *ref = b;
+    m->dirty = 1;
+    im->pinned--;
+    return 0;
+}
+
+/* Read checkpoint region 'region' into the state and return its seq, or
+ * 0 if it is not a valid checkpoint.
+ */
+static block_no logdisk_load(struct logdisk_state *ls, block_no region) {
+    union logdisk_block header;
+    if ((*ls->below->read)(ls->below, ls->below_ino, region, &header.datablock) < 0 ||
+        header.header.magic != LOGDISK_MAGIC)
+        return 0;
+
+    for (block_no i = 0; i < ls->sb.n_imapblocks; i++)
+        if ((*ls->below->read)(ls->below, ls->below_ino, region + 1 + i,
+                               (block_t *) ((char *) ls->imap + i * BLOCK_SIZE)) < 0)
+            return 0;
+    for (block_no i = 0; i < ls->sb.n_usageblocks; i++)
+        if ((*ls->below->read)(ls->below, ls->below_ino, region + 1 + ls->sb.n_imapblocks + i,
+                               (block_t *) ((char *) ls->usage + i * BLOCK_SIZE)) < 0)
+            return 0;
+    if (header.header.checksum != logdisk_checksum(ls))
+        return 0;
+
+    ls->head_segment = header.header.head_segment;
+    ls->head_offset = header.header.head_offset;
+    return header.header.seq;
+}
+
+inode_store_t *logdisk_init(inode_store_t *below, unsigned int below_ino) {
+    union logdisk_block superblock;
+    if ((*below->read)(below, below_ino, 0, &superblock.datablock) < 0 ||
+        superblock.superblock.magic != LOGDISK_MAGIC)
+        return NULL;
+
+    struct logdisk_state *ls = malloc(sizeof(struct logdisk_state));
+    memset(ls, 0, sizeof(struct logdisk_state));
+    ls->below = below;
+    ls->below_ino = below_ino;
+    memcpy(&ls->sb, &superblock.superblock, sizeof(ls->sb));
+    ls->imap = malloc(ls->sb.n_imapblocks * BLOCK_SIZE);
+    ls->usage = malloc(ls->sb.n_usageblocks * BLOCK_SIZE);
+    ls->reusable = malloc(ls->sb.nsegments);
+
+    /* Load the valid checkpoint with the larger seq.
+     */
+    block_no region_nblocks = 1 + ls->sb.n_imapblocks + ls->sb.n_usageblocks;
+    union logdisk_block header[2];
+    for (int r = 0; r < 2; r++)
+        if ((*below->read)(below, below_ino, 1 + r * region_nblocks, &header[r].datablock) < 0)
+            panic("logdisk_init: checkpoint");
+    int newer = (header[1].header.magic == LOGDISK_MAGIC &&
+                 (header[0].header.magic != LOGDISK_MAGIC || header[1].header.seq > header[0].header.seq));
+    if ((ls->seq = logdisk_load(ls, 1 + newer * region_nblocks)) == 0 &&
+        (ls->seq = logdisk_load(ls, 1 + !newer * region_nblocks)) == 0)
+        panic("logdisk_init: no valid checkpoint");
+    for (block_no s = 0; s < ls->sb.nsegments; s++)
+        ls->reusable[s] = (ls->usage[s] == 0 && s != ls->head_segment);
+
+    /* The app memory on the Arty board only fits a few metadata blocks.
+     */
+    ls->nmeta = LOGDISK_NMETA;
+#ifndef MKFS
+    if (earth->platform == ARTY)
+        ls->nmeta = LOGDISK_NMETA_ARTY;
+#endif
+    ls->meta = malloc(ls->nmeta * sizeof(struct logdisk_meta));
+    memset(ls->meta, 0, ls->nmeta * sizeof(struct logdisk_meta));
+
+    inode_store_t *this_bs = malloc(sizeof(inode_store_t));
+    memset(this_bs, 0, sizeof(inode_store_t));
+    this_bs->state = ls;
+    this_bs->getsize = logdisk_getsize;
+    this_bs->setsize = logdisk_setsize;
+    this_bs->read = logdisk_read;
+    this_bs->write = logdisk_write;
+    this_bs->readv = logdisk_readv;
+    return this_bs;
+}
+
+/* Create a new logdisk file system, with an empty log and a checkpoint in
+ * the second region.
+ */
+int logdisk_create(inode_store_t *below, unsigned int below_ino, unsigned int ninodes) {
+    if (sizeof(union logdisk_block) != BLOCK_SIZE)
+        panic("logdisk_create: block has wrong size");
+
+    union logdisk_block block;
+    memset(&block, 0, BLOCK_SIZE);
+    struct logdisk_superblock *sb = &block.superblock;
+    sb->magic = LOGDISK_MAGIC;
+    sb->nblocks = (*below->getsize)(below, below_ino);
+    sb->ninodes = ninodes;
+    sb->n_imapblocks = (ninodes * sizeof(block_no) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    sb->n_usageblocks = (sb->nblocks / LOGDISK_SEGMENT_NBLOCKS * sizeof(unsigned short) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    block_no region_nblocks = 1 + sb->n_imapblocks + sb->n_usageblocks;
+    sb->first_segment = 1 + 2 * region_nblocks;
+    if (sb->nblocks < sb->first_segment + (LOGDISK_MIN_FREE + 1) * LOGDISK_SEGMENT_NBLOCKS) {
+        printf("logdisk_create: too few blocks\n");
+        return -1;
+    }
+    sb->nsegments = (sb->nblocks - sb->first_segment) / LOGDISK_SEGMENT_NBLOCKS;
+    if ((*below->write)(below, below_ino, 0, &block.datablock) < 0)
+        return -1;
+
+    /* An empty imap and usage table, and no valid header in region 0.
+     */
+    struct logdisk_superblock saved = *sb;
+    memset(&block, 0, BLOCK_SIZE);
+    for (block_no i = 0; i < 2 * region_nblocks; i++)
+        if ((*below->write)(below, below_ino, 1 + i, &block.datablock) < 0)
+            return -1;
+
+    struct logdisk_state ls;
+    memset(&ls, 0, sizeof(ls));
+    ls.sb = saved;
+    ls.imap = calloc(saved.n_imapblocks, BLOCK_SIZE);
+    ls.usage = calloc(saved.n_usageblocks, BLOCK_SIZE);
+    block.header.magic = LOGDISK_MAGIC;
+    block.header.seq = 1;
+    block.header.checksum = logdisk_checksum(&ls);
+    int r = (*below->write)(below, below_ino, 1 + region_nblocks, &block.datablock);
+    free(ls.imap);
+    free(ls.usage);
+    return r;
+}
@@ -0,0 +1,63 @@
+/* Description: the layout of a logdisk file system
+ * A logdisk is a log-structured alternative to a treedisk (see file.h).
+ * Blocks are never updated in place: every data block, map block and inode
+ * written is appended to the log, which fills one segment of
+ * LOGDISK_SEGMENT_NBLOCKS contiguous blocks after the other.  An inode
+ * takes a whole block and points to up to LOGDISK_NMAPS map blocks, each
+ * holding the block numbers of LOGDISK_REFS_PER_BLOCK blocks of the file;
+ * block number 0 is a hole.  The inode map (imap) holds the block number
+ * of every inode, and the segment usage table the number of live blocks in
+ * every segment.  Both are written with a header to one of the two
+ * checkpoint regions after the superblock, alternately, so that the other
+ * region stays valid if the system stops while writing a checkpoint.
+ * The header is written last; its seq is incremented at every checkpoint
+ * and its checksum covers the imap and the usage table.
+ * Unlike a treedisk, a logdisk does not grow when it is opened on a larger
+ * inode store, e.g., a microSD card: it keeps the segments made by mkfs.
+ */
+#pragma once
+#include "inode.h"
+
+#define LOGDISK_MAGIC            0x4c4f4744    /* "LOGD" */
+#define LOGDISK_SEGMENT_NBLOCKS  32
+#define LOGDISK_REFS_PER_BLOCK   (BLOCK_SIZE / sizeof(block_no))
+#define LOGDISK_NMAPS            (LOGDISK_REFS_PER_BLOCK - 1)
+#define LOGDISK_MAX_NBLOCKS      (LOGDISK_NMAPS * LOGDISK_REFS_PER_BLOCK)
+
+struct logdisk_superblock {
+    block_no magic;                     /* LOGDISK_MAGIC */
+    block_no nblocks;                   /* # blocks in the file system */
+    block_no ninodes;                   /* # inodes */
+    block_no n_imapblocks;              /* # blocks of the imap */
+    block_no n_usageblocks;             /* # blocks of the segment usage table */
+    block_no nsegments;                 /* # segments */
+    block_no first_segment;             /* block number of segment 0 */
+};
+
+/* A checkpoint region is this header, n_imapblocks blocks of imap and
+ * n_usageblocks blocks of segment usage table.
+ */
+struct logdisk_header {
+    block_no magic;                     /* LOGDISK_MAGIC */
+    block_no seq;                       /* # checkpoints so far */
+    block_no head_segment;              /* segment the log is appended to */
+    block_no head_offset;               /* # blocks of it already written */
+    block_no checksum;                  /* of the imap and usage table */
+};
+
+struct logdisk_inode {
+    block_no nblocks;                   /* total size of the file */
+    block_no maps[LOGDISK_NMAPS];       /* map blocks, 0 if none */
+};
+
+struct logdisk_mapblock {
+    block_no refs[LOGDISK_REFS_PER_BLOCK];
+};
+
+union logdisk_block {
+    block_t datablock;
+    struct logdisk_superblock superblock;
+    struct logdisk_header header;
+    struct logdisk_inode inode;
+    struct logdisk_mapblock map;
+};
@@ -4,22 +4,39 @@
  */
 
 /* Author: Yunhao Zhang
- * Description: system support to C library function malloc()
+ * Description: a slab allocator for malloc() and free()
+ * Every process links its own copy of this file and thus has its own
+ * arena, i.e., a contiguous heap starting at &__heap_start. The arena is
+ * cut into 1KB slabs (4 slabs per 4KB page) and grows page by page.
+ * A small request is served by a slab holding objects of one size class;
+ * a large request is served by a run of whole slabs. Both malloc() and
+ * free() of small objects are O(1); free runs are merged lazily.
  */
 
 #include "egos.h"
+#include "malloc.h"
+#include <string.h>
 
 extern char __heap_start, __heap_end;
 static char* brk = &__heap_start;
+static char* mapped;  /* first heap page not mapped yet */
 
-/* malloc() and free() are linked from the compiler's C library;
- * malloc() and free() manage the memory region [&__heap_start, brk).
- * If malloc() finds this region to be too small, it will call _sbrk().
+/* _sbrk() moves the end of the heap forward by size bytes.
+ * The heap pages of an app beyond its ELF image are mapped by the grass
+ * kernel on demand, up to a per-process limit.
  */
-
 char *_sbrk(int size) {
     char* heap_end = (earth->platform == QEMU)? (char*)0xa000000: (&__heap_end);
-    if (brk + size > heap_end) {
+    int too_large = (brk + size > heap_end);
+
+    if (mapped == NULL)
+        mapped = (char*)(((unsigned int)&__heap_start + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+    if (!too_large && &__heap_start >= (char*)APPS_ENTRY && brk + size > mapped) {
+        too_large = grass->sys_brk(mapped, brk + size);
+        mapped = (char*)(((unsigned int)brk + size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+    }
+
+    if (too_large) {
         earth->tty_write("_sbrk: heap grows too large\r\n", 29);
         *(int*)(0xFFFFFFF0) = 1; /* Trigger a memory exception */
     }
@@ -28,3 +45,266 @@ char *_sbrk(int size) {
     brk += size;
     return old_brk;
 }
+
+#define SLAB_SIZE    1024
+#define NCLASSES     5     /* objects of 16, 32, 64, 128 and 256 bytes */
+#define SLAB_FREE    -1
+#define SLAB_LARGE   -2
+
+struct object {
+    struct object* next;
+};
+
+/* Every slab starts with this header, so free() finds the header of
+ * any object by rounding the object address down to a slab boundary.
+ * A large allocation or a free run only has a header in its first slab.
+ */
+struct slab {
+    int class;                 /* SLAB_FREE, SLAB_LARGE or a size class */
+    int nslabs;                /* length of a free run or large allocation */
+    int nfree;                 /* number of free objects in this slab */
+    struct object* objects;    /* free objects in this slab */
+    struct slab *prev, *next;  /* free runs, or slabs with free objects */
+};
+#define HEADER_SIZE  ((sizeof(struct slab) + 15) & ~15)
+#define CLASS_SIZE(class)   (16 << (class))
+#define CLASS_NOBJS(class)  ((SLAB_SIZE - HEADER_SIZE) / CLASS_SIZE(class))
+
+static char *arena_start, *arena_end;
+static struct slab* free_runs;
+static struct slab* partial[NCLASSES];
+static struct heap_stats stats;
+
+static void list_insert(struct slab** head, struct slab* slab) {
+    slab->prev = NULL;
+    slab->next = *head;
+    if (*head) (*head)->prev = slab;
+    *head = slab;
+}
+
+static void list_remove(struct slab** head, struct slab* slab) {
+    if (slab->prev) slab->prev->next = slab->next;
+    else *head = slab->next;
+    if (slab->next) slab->next->prev = slab->prev;
+}
+
+static struct slab* slab_at(char* addr) {
+    return (void*)(arena_start + (addr - arena_start) / SLAB_SIZE * SLAB_SIZE);
+}
+
+static void run_free(struct slab* run, int nslabs) {
+    stats.free_slabs += nslabs;
+
+    /* Merge with the run right after, if it is free */
+    struct slab* next = (void*)((char*)run + nslabs * SLAB_SIZE);
+    if ((char*)next < arena_end && next->class == SLAB_FREE) {
+        list_remove(&free_runs, next);
+        nslabs += next->nslabs;
+    }
+
+    run->class = SLAB_FREE;
+    run->nslabs = nslabs;
+    list_insert(&free_runs, run);
+}
+
+static struct slab* arena_grow(int nslabs) {
+    if (arena_start == NULL) {
+        int pad = (16 - (unsigned int)_sbrk(0) % 16) % 16;
+        arena_start = arena_end = _sbrk(pad) + pad;
+    }
+
+    /* Grow to a page boundary and keep the extra slabs as a free run */
+    char* end = arena_end + nslabs * SLAB_SIZE;
+    char* page_end = (char*)(((unsigned int)end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+    char* heap_end = (earth->platform == QEMU)? (char*)0xa000000: (&__heap_end);
+    int nextra = (page_end <= heap_end)? (page_end - end) / SLAB_SIZE : 0;
+
+    struct slab* run = (void*)_sbrk((nslabs + nextra) * SLAB_SIZE);
+    arena_end = (char*)run + (nslabs + nextra) * SLAB_SIZE;
+    stats.arena_slabs += nslabs + nextra;
+    if (nextra) run_free((void*)((char*)run + nslabs * SLAB_SIZE), nextra);
+
+    return run;
+}
+
+/* Merge adjacent free runs by walking the headers of the whole arena.
+ * This is deferred until an allocation would otherwise grow the arena.
+ */
+static void arena_coalesce() {
+    struct slab *unit, *run = NULL;
+    free_runs = NULL;
+
+    for (char* next = arena_start; next < arena_end; ) {
+        unit = (void*)next;
+        next += unit->nslabs * SLAB_SIZE;
+
+        if (unit->class != SLAB_FREE) {
+            run = NULL;
+        } else if (run) {
+            run->nslabs += unit->nslabs;
+        } else {
+            run = unit;
+            list_insert(&free_runs, run);
+        }
+    }
+}
+
+static struct slab* run_find(int nslabs) {
+    /* First fit over the free runs */
+    for (struct slab* run = free_runs; run; run = run->next)
+        if (run->nslabs >= nslabs) {
+            list_remove(&free_runs, run);
+            if (run->nslabs > nslabs) {
+                struct slab* rest = (void*)((char*)run + nslabs * SLAB_SIZE);
+                rest->class = SLAB_FREE;
+                rest->nslabs = run->nslabs - nslabs;
+                list_insert(&free_runs, rest);
+            }
+            stats.free_slabs -= nslabs;
+            return run;
+        }
+    return NULL;
+}
+
+static struct slab* run_alloc(int nslabs) {
+    struct slab* run = run_find(nslabs);
+    if (run) return run;
+
+    arena_coalesce();
+    if ((run = run_find(nslabs))) return run;
+
+    /* Extend the free run at the end of the arena, if any */
+    for (run = free_runs; run; run = run->next)
+        if ((char*)run + run->nslabs * SLAB_SIZE == arena_end) {
+            list_remove(&free_runs, run);
+            stats.free_slabs -= run->nslabs;
+            arena_grow(nslabs - run->nslabs);
+            return run;
+        }
+
+    return arena_grow(nslabs);
+}
+
+static struct slab* slab_alloc(int class) {
+    struct slab* slab = run_alloc(1);
+    slab->class = class;
+    slab->nslabs = 1;
+    slab->nfree = 0;
+    slab->objects = NULL;
+
+    int size = CLASS_SIZE(class);
+    for (int i = CLASS_NOBJS(class) - 1; i >= 0; i--) {
+        struct object* obj = (void*)((char*)slab + HEADER_SIZE + i * size);
+        obj->next = slab->objects;
+        slab->objects = obj;
+        slab->nfree++;
+    }
+
+    list_insert(&partial[class], slab);
+    return slab;
+}
+
+static int usable_size(struct slab* slab) {
+    if (slab->class == SLAB_LARGE)
+        return slab->nslabs * SLAB_SIZE - HEADER_SIZE;
+    return CLASS_SIZE(slab->class);
+}
+
+void* malloc(size_t size) {
+    stats.nmalloc++;
+
+    int class = 0;
+    while (class < NCLASSES && CLASS_SIZE(class) < size) class++;
+
+    if (class == NCLASSES) {
+        /* No arena can hold more than half of the address space */
+        if (size > ((size_t)-1 >> 1)) return NULL;
+        int nslabs = (size + HEADER_SIZE + SLAB_SIZE - 1) / SLAB_SIZE;
+        struct slab* run = run_alloc(nslabs);
+        run->class = SLAB_LARGE;
+        run->nslabs = nslabs;
+        stats.bytes_used += usable_size(run);
+        return (char*)run + HEADER_SIZE;
+    }
+
+    struct slab* slab = partial[class]? partial[class] : slab_alloc(class);
+    struct object* obj = slab->objects;
+    slab->objects = obj->next;
+    if (--slab->nfree == 0) list_remove(&partial[class], slab);
+
+    stats.bytes_used += CLASS_SIZE(class);
+    return obj;
+}
+
+void free(void* ptr) {
+    if (ptr == NULL) return;
+    stats.nfree++;
+
+    struct slab* slab = slab_at(ptr);
+    stats.bytes_used -= usable_size(slab);
+    if (slab->class == SLAB_LARGE) {
+        run_free(slab, slab->nslabs);
+        return;
+    }
+
+    int class = slab->class;
+    struct object* obj = ptr;
+    obj->next = slab->objects;
+    slab->objects = obj;
+    if (slab->nfree++ == 0) list_insert(&partial[class], slab);
+
+    /* Keep one slab per class around to avoid thrashing */
+    if (slab->nfree == CLASS_NOBJS(class) && partial[class] != slab) {
+        list_remove(&partial[class], slab);
+        run_free(slab, 1);
+    }
+}
+
+void* calloc(size_t nmemb, size_t size) {
+    if (size != 0 && nmemb > (size_t)-1 / size) return NULL;
+
+    void* ptr = malloc(nmemb * size);
+    if (ptr) memset(ptr, 0, nmemb * size);
+    return ptr;
+}
+
+void* realloc(void* ptr, size_t size) {
+    if (ptr == NULL) return malloc(size);
+
+    int old_size = usable_size(slab_at(ptr));
+    if (size <= old_size) return ptr;
+
+    void* new_ptr = malloc(size);
+    if (new_ptr == NULL) return NULL;
+    memcpy(new_ptr, ptr, old_size);
+    free(ptr);
+    return new_ptr;
+}
+
+/* The C library calls the reentrant versions internally (e.g., for the
+ * stdio buffers), so they share the same arena.
+ */
+struct _reent;
+void* _malloc_r(struct _reent* r, size_t size) { return malloc(size); }
+void _free_r(struct _reent* r, void* ptr) { free(ptr); }
+void* _calloc_r(struct _reent* r, size_t nmemb, size_t size) { return calloc(nmemb, size); }
+void* _realloc_r(struct _reent* r, void* ptr, size_t size) { return realloc(ptr, size); }
+
+void heap_stats(struct heap_stats* result) {
+    if (arena_start) arena_coalesce();
+
+    stats.free_runs = stats.largest_run = 0;
+    for (struct slab* run = free_runs; run; run = run->next) {
+        stats.free_runs++;
+        if (run->nslabs > stats.largest_run) stats.largest_run = run->nslabs;
+    }
+    memcpy(result, &stats, sizeof(stats));
+}
+
+void heap_info() {
+    struct heap_stats st;
+    heap_stats(&st);
+    INFO("heap: %d malloc, %d free, %d bytes in use", st.nmalloc, st.nfree, st.bytes_used);
+    INFO("heap: %d/%d slabs free in %d runs, largest run %d slabs",
+         st.free_slabs, st.arena_slabs, st.free_runs, st.largest_run);
+}
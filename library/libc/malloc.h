@@ -0,0 +1,15 @@
+#pragma once
+
+/* Statistics of the slab allocator in library/libc/malloc.c */
+struct heap_stats {
+    int nmalloc;       /* number of malloc() calls */
+    int nfree;         /* number of free() calls */
+    int bytes_used;    /* bytes in use, rounded up to the size classes */
+    int arena_slabs;   /* number of 1KB slabs in the arena */
+    int free_slabs;    /* number of slabs in free runs */
+    int free_runs;     /* number of free runs */
+    int largest_run;   /* number of slabs in the largest free run */
+};
+
+void heap_stats(struct heap_stats* stats);
+void heap_info();
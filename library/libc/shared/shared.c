@@ -0,0 +1,13 @@
+/* Description: the shared libc
+ * The string functions of the C library and library/servers are linked
+ * once as build/release/libc.elf at LIBC_ENTRY, i.e., in the exec segment
+ * LIBC_EXEC_START of the disk image in the on-board ROM. Every process can
+ * execute this code in place, so apps only link against its symbols (see
+ * LIBC_EXPORTS in the Makefile) instead of linking their own copies.
+ * The code runs in the ROM and thus cannot have writable data.
+ */
+
+#include "egos.h"
+
+struct grass *grass = (void*)APPS_STACK_TOP;
+struct earth *earth = (void*)GRASS_STACK_TOP;
@@ -12,26 +12,48 @@
 #include "servers.h"
 #include <string.h>
 
-static int sender;
-static char buf[SYSCALL_MSG_LEN];
+/* These functions are part of the shared libc in the ROM (see
+ * library/libc/shared), so they keep their state on the stack.
+ */
 
 void exit(int status) {
     grass->sys_exit(status);
     while(1);
 }
 
-int dir_lookup(int dir_ino, char* name) {
-    struct dir_request req;
-    req.type = DIR_LOOKUP;
+/* Directories are resolved by GPID_FILE directly on its inode store */
+static int dir_request(int type, int dir_ino, int offset, char* name, struct file_reply* reply) {
+    struct file_request req;
+    req.type = type;
     req.ino = dir_ino;
-    strcpy(req.name, name);
-    grass->sys_send(GPID_DIR, (void*)&req, sizeof(req));
+    req.offset = offset;
+    if (name) {
+        strncpy((char*)req.block.bytes, name, DIR_PATH_SIZE);
+        req.block.bytes[DIR_PATH_SIZE - 1] = 0;
+    }
+    grass->sys_send(GPID_FILE, (void*)&req, sizeof(req));
 
-    grass->sys_recv(&sender, buf, SYSCALL_MSG_LEN);
-    if (sender != GPID_DIR) FATAL("dir_lookup: an error occurred");
-    struct dir_reply *reply = (void*)buf;
+    int sender;
+    grass->sys_recv(&sender, (void*)reply, sizeof(*reply));
+    if (sender != GPID_FILE) FATAL("dir_request: an error occurred");
+    return reply->status == FILE_OK? 0 : -1;
+}
 
-    return reply->status == DIR_OK? reply->ino : -1;
+int dir_lookup(int dir_ino, char* name) {
+    struct file_reply reply;
+    return dir_request(FILE_LOOKUP, dir_ino, 0, name, &reply) == 0? reply.ino : -1;
+}
+
+int dir_lookup_path(int dir_ino, char* path) {
+    struct file_reply reply;
+    return dir_request(FILE_LOOKUP_PATH, dir_ino, 0, path, &reply) == 0? reply.ino : -1;
+}
+
+int dir_readdir(int dir_ino, int block_no, struct dir_entry* entries) {
+    struct file_reply reply;
+    if (dir_request(FILE_READDIR, dir_ino, block_no, NULL, &reply) < 0) return -1;
+    memcpy(entries, reply.block.bytes, reply.nentries * sizeof(struct dir_entry));
+    return reply.nentries;
 }
 
 int file_read(int file_ino, int offset, char* block) {
@@ -41,10 +63,146 @@ int file_read(int file_ino, int offset, char* block) {
     req.offset = offset;
     grass->sys_send(GPID_FILE, (void*)&req, sizeof(req));
 
-    grass->sys_recv(&sender, buf, SYSCALL_MSG_LEN);
+    int sender;
+    struct file_reply reply;
+    grass->sys_recv(&sender, (void*)&reply, sizeof(reply));
     if (sender != GPID_FILE) FATAL("file_read: an error occurred");
-    struct file_reply *reply = (void*)buf;
-    memcpy(block, reply->block.bytes, BLOCK_SIZE);
+    memcpy(block, reply.block.bytes, BLOCK_SIZE);
+
+    return reply.status == FILE_OK? 0 : -1;
+}
+
+/* Receive the reply to FILE_READV or FILE_READ_NEXT into blocks[] and
+ * return the number of blocks, or -1 upon error.
+ */
+static int file_recv_blocks(char* blocks) {
+    int sender;
+    struct file_reply reply;
+    grass->sys_recv(&sender, (void*)&reply, sizeof(reply));
+    if (sender != GPID_FILE) FATAL("file_recv_blocks: an error occurred");
+    if (reply.status != FILE_OK) return -1;
+    memcpy(blocks, reply.block.bytes, BLOCK_SIZE);
+
+    /* The other blocks come in full messages, straight into blocks[] */
+    int nblocks = reply.nblocks;
+    for (int i = 1; i < nblocks; i += FILE_READV_MSG_NBLOCKS) {
+        int n = (nblocks - i < FILE_READV_MSG_NBLOCKS)? nblocks - i : FILE_READV_MSG_NBLOCKS;
+        grass->sys_recv(&sender, blocks + i * BLOCK_SIZE, n * BLOCK_SIZE);
+        if (sender != GPID_FILE) FATAL("file_recv_blocks: an error occurred");
+    }
+    return nblocks;
+}
+
+int file_readv(int file_ino, int offset, int nblocks, char* blocks) {
+    struct file_request req;
+    req.type = FILE_READV;
+    req.ino = file_ino;
+    req.offset = offset;
+    req.nblocks = nblocks;
+    grass->sys_send(GPID_FILE, (void*)&req, sizeof(req));
+    return file_recv_blocks(blocks) < 0? -1 : 0;
+}
+
+/* Write len bytes of src at byte pos of the file, one request per block */
+int file_pwrite(int file_ino, unsigned int pos, int len, char* src) {
+    struct file_request req;
+    req.type = FILE_WRITE;
+    req.ino = file_ino;
+
+    int sender;
+    struct file_reply reply;
+    while (len > 0) {
+        req.offset = pos / BLOCK_SIZE;
+        req.start = pos % BLOCK_SIZE;
+        req.len = (len < BLOCK_SIZE - req.start)? len : BLOCK_SIZE - req.start;
+        memcpy(req.block.bytes, src, req.len);
+        grass->sys_send(GPID_FILE, (void*)&req, sizeof(req));
+        grass->sys_recv(&sender, (void*)&reply, sizeof(reply));
+        if (sender != GPID_FILE) FATAL("file_pwrite: an error occurred");
+        if (reply.status != FILE_OK) return -1;
+
+        pos += req.len;
+        src += req.len;
+        len -= req.len;
+    }
+    return 0;
+}
 
+int file_write(int file_ino, int offset, char* block) {
+    return file_pwrite(file_ino, offset * BLOCK_SIZE, BLOCK_SIZE, block);
+}
+
+/* Send a request without a block, e.g., about an open file, and return
+ * the reply status */
+static int file_handle_request(int type, int fd, int offset, struct file_reply* reply) {
+    struct file_request req;
+    req.type = type;
+    req.ino = fd;
+    req.offset = offset;
+    grass->sys_send(GPID_FILE, (void*)&req, sizeof(req));
+
+    int sender;
+    grass->sys_recv(&sender, (void*)reply, sizeof(*reply));
+    if (sender != GPID_FILE) FATAL("file_handle_request: an error occurred");
     return reply->status == FILE_OK? 0 : -1;
 }
+
+int file_setsize(int file_ino, int nblocks) {
+    struct file_request req;
+    req.type = FILE_SETSIZE;
+    req.ino = file_ino;
+    req.nblocks = nblocks;
+    grass->sys_send(GPID_FILE, (void*)&req, sizeof(req));
+
+    int sender;
+    struct file_reply reply;
+    grass->sys_recv(&sender, (void*)&reply, sizeof(reply));
+    if (sender != GPID_FILE) FATAL("file_setsize: an error occurred");
+    return reply.status == FILE_OK? 0 : -1;
+}
+
+/* Writes are only durable on the disk once file_sync() returns 0 */
+int file_sync() {
+    struct file_reply reply;
+    return file_handle_request(FILE_SYNC, 0, 0, &reply);
+}
+
+int file_alloc() {
+    struct file_reply reply;
+    if (file_handle_request(FILE_ALLOC, 0, 0, &reply) < 0) return -1;
+    return reply.ino;
+}
+
+int file_free(int file_ino) {
+    struct file_reply reply;
+    return file_handle_request(FILE_FREE, file_ino, 0, &reply);
+}
+
+int file_open(int file_ino, int* nblocks) {
+    struct file_reply reply;
+    if (file_handle_request(FILE_OPEN, file_ino, 0, &reply) < 0) return -1;
+    if (nblocks) *nblocks = reply.nblocks;
+    return reply.ino;
+}
+
+int file_close(int fd) {
+    struct file_reply reply;
+    return file_handle_request(FILE_CLOSE, fd, 0, &reply);
+}
+
+int file_seek(int fd, int offset) {
+    struct file_reply reply;
+    return file_handle_request(FILE_SEEK, fd, offset, &reply);
+}
+
+/* Read up to nblocks blocks at the position of fd; return the number of
+ * blocks read, or -1 at the end of the file.
+ */
+int file_read_next(int fd, int nblocks, char* blocks) {
+    struct file_request req;
+    req.type = FILE_READ_NEXT;
+    req.ino = fd;
+    req.nblocks = nblocks;
+    grass->sys_send(GPID_FILE, (void*)&req, sizeof(req));
+    return file_recv_blocks(blocks);
+}
@@ -1,11 +1,48 @@
 #pragma once
 
 #include "inode.h"
+#include "dir.h"
+#include "malloc.h"
 #define SYSCALL_MSG_LEN    1024
 
 void exit(int status);
 int dir_lookup(int dir_ino, char* name);
+int dir_lookup_path(int dir_ino, char* path);
+int dir_readdir(int dir_ino, int block_no, struct dir_entry* entries);
+int file_open(int file_ino, int* nblocks);
+int file_close(int fd);
+int file_seek(int fd, int offset);
+int file_read_next(int fd, int nblocks, char* blocks);
 int file_read(int file_ino, int offset, char* block);
+int file_readv(int file_ino, int offset, int nblocks, char* blocks);
+int file_write(int file_ino, int offset, char* block);
+int file_pwrite(int file_ino, unsigned int pos, int len, char* src);
+int file_setsize(int file_ino, int nblocks);
+int file_sync();
+int file_alloc();
+int file_free(int file_ino);
+
+/* Buffered streams on open files (see library/servers/stream.c), named
+ * apart from the stdio of newlib.  The app gives a buffer of buf_nblocks
+ * blocks, e.g., FSTREAM_NBLOCKS; a path is relative to grass->workdir_ino.
+ */
+#define FSTREAM_NBLOCKS   4
+struct fstream {
+    int fd;                  /* handle of the open file in GPID_FILE */
+    int nblocks;             /* size of the file in blocks */
+    char* buf;
+    int buf_nblocks;
+    int buf_start, buf_len;  /* blocks [buf_start, buf_start + buf_len) are in buf */
+    int next;                /* block that FILE_READ_NEXT returns next */
+    unsigned int pos;        /* position in bytes */
+};
+
+int fstream_open(struct fstream* f, char* path, char* buf, int buf_nblocks);
+int fstream_close(struct fstream* f);
+int fstream_read(struct fstream* f, char* dst, int len);
+int fstream_getc(struct fstream* f);
+char* fstream_gets(struct fstream* f, char* dst, int len);
+int fstream_seek(struct fstream* f, unsigned int pos);
 
 enum grass_servers {
     GPID_UNUSED,
@@ -37,34 +74,95 @@ struct proc_reply {
 };
 
 /* GPID_FILE */
+/* The reply to FILE_READV is a file_reply with the first block, followed
+ * by messages of FILE_READV_MSG_NBLOCKS blocks each for the other blocks.
+ * The file server also resolves directories (see library/file/dir.h):
+ * FILE_LOOKUP and FILE_LOOKUP_PATH carry the name or path in block and
+ * reply with ino; FILE_READDIR replies with the nentries entries of
+ * directory block offset in block.
+ * FILE_OPEN replies with a handle in ino and the size of the file in
+ * nblocks.  FILE_CLOSE, FILE_SEEK and FILE_READ_NEXT take the handle in
+ * ino; FILE_READ_NEXT replies like FILE_READV with the next nblocks blocks
+ * (fewer at the end of the file) and moves the position after them.
+ * GPID_PROCESS sends FILE_EXIT without waiting for a reply when process
+ * ino is freed, or with ino -1 when all user apps are killed, so that
+ * the file server closes the handles left open by these processes.
+ * FILE_WRITE writes the first len bytes of block at byte start of block
+ * offset, which is below FILE_MAX_NBLOCKS like the size of a file, and
+ * fails if the file system is full.  Writes are cached by the file
+ * server and only durable after FILE_SYNC, i.e., file_sync(); the server
+ * also syncs when a handle is closed, when a process exits and some
+ * requests later, but never after a delay while it is idle (see
+ * apps/system/sys_file.c).
+ * FILE_ALLOC replies with a free inode in ino and FILE_FREE frees inode
+ * ino and its blocks; only a treedisk keeps track of free inodes.
+ * Nothing can name an allocated inode yet, as GPID_DIR does not implement
+ * DIR_INSERT.
+ */
+#define FILE_READV_NBLOCKS      8
+#define FILE_MAX_NBLOCKS        (0x100000000ULL / BLOCK_SIZE)  /* 32-bit byte positions */
+#define FILE_READV_MSG_NBLOCKS  (SYSCALL_MSG_LEN / BLOCK_SIZE)
 struct file_request {
     enum {
           FILE_UNUSED,
           FILE_READ,
           FILE_WRITE,
+          FILE_READV,
+          FILE_STATS,
+          FILE_LOOKUP,
+          FILE_LOOKUP_PATH,
+          FILE_READDIR,
+          FILE_OPEN,
+          FILE_CLOSE,
+          FILE_SEEK,
+          FILE_READ_NEXT,
+          FILE_SETSIZE,
+          FILE_SYNC,
+          FILE_ALLOC,
+          FILE_FREE,
+          FILE_EXIT,
     } type;
     unsigned int ino;
     unsigned int offset;
+    unsigned int nblocks;
+    unsigned int start, len;
     block_t block;
 };
 
 struct file_reply {
     enum file_status { FILE_OK, FILE_ERROR } status;
+    int ino, nentries, nblocks;
     block_t block;
 };
 
+/* The reply to FILE_STATS holds the read-ahead counters and the heap
+ * statistics of the file server in its block */
+struct file_stats {
+    unsigned int prefetched;   /* blocks read ahead */
+    unsigned int hits;         /* prefetched blocks read by a client */
+    unsigned int wasted;       /* prefetched blocks dropped unread */
+    struct heap_stats heap;    /* caches and pinned tables in the heap */
+};
+
 
 /* GPID_DIR */
+/* GPID_DIR forwards directory requests to GPID_FILE for compatibility.
+ * DIR_LOOKUP_PATH resolves a path like "/bin/ls" or "home/yunhao/" in one
+ * request; a relative path starts from directory ino.
+ */
 #define DIR_NAME_SIZE   32
+#define DIR_PATH_SIZE   128
 struct dir_request {
     enum {
           DIR_UNUSED,
           DIR_LOOKUP,
           DIR_INSERT,
-          DIR_REMOVE
+          DIR_REMOVE,
+          DIR_LOOKUP_PATH
     } type;
     int ino;
     char name[DIR_NAME_SIZE];
+    char path[DIR_PATH_SIZE];
 };
 
 struct dir_reply {
@@ -0,0 +1,89 @@
+/* Description: buffered streams on the open files of GPID_FILE
+ * A stream reads a file through a handle of the file server and keeps
+ * a buffer of several blocks given by the app.  When the reader leaves
+ * the buffer, the whole buffer is filled ahead with FILE_READ_NEXT, i.e.,
+ * FILE_READV_NBLOCKS blocks per request without sending any offset, and
+ * the file server reads further ahead while the app consumes the buffer.
+ * Like the other functions of library/servers, these run in the shared
+ * libc and keep all their state in the fstream of the app.
+ */
+
+#include "egos.h"
+#include "servers.h"
+#include <string.h>
+
+int fstream_open(struct fstream* f, char* path, char* buf, int buf_nblocks) {
+    int ino = dir_lookup_path(grass->workdir_ino, path);
+    if (ino < 0 || buf_nblocks < 1) return -1;
+
+    f->fd = file_open(ino, &f->nblocks);
+    if (f->fd < 0) return -1;
+
+    f->buf = buf;
+    f->buf_nblocks = buf_nblocks;
+    f->buf_start = f->buf_len = f->next = 0;
+    f->pos = 0;
+    return 0;
+}
+
+int fstream_close(struct fstream* f) {
+    return file_close(f->fd);
+}
+
+/* Make sure the block at the position is in the buffer */
+static int fstream_fill(struct fstream* f) {
+    int block_no = f->pos / BLOCK_SIZE;
+    if (block_no >= f->buf_start && block_no < f->buf_start + f->buf_len) return 0;
+    if (block_no >= f->nblocks) return -1;
+    if (block_no != f->next && file_seek(f->fd, block_no) < 0) return -1;
+
+    f->buf_start = block_no;
+    f->buf_len = 0;
+    while (f->buf_len < f->buf_nblocks && block_no + f->buf_len < f->nblocks) {
+        int n = f->buf_nblocks - f->buf_len;
+        n = (n < FILE_READV_NBLOCKS)? n : FILE_READV_NBLOCKS;
+        int r = file_read_next(f->fd, n, f->buf + f->buf_len * BLOCK_SIZE);
+        if (r < 0) break;
+        f->buf_len += r;
+    }
+    f->next = block_no + f->buf_len;
+    return (f->buf_len > 0)? 0 : -1;
+}
+
+int fstream_read(struct fstream* f, char* dst, int len) {
+    int n = 0;
+    while (n < len && fstream_fill(f) == 0) {
+        int offset = f->pos - f->buf_start * BLOCK_SIZE;
+        int m = f->buf_len * BLOCK_SIZE - offset;
+        if (m > len - n) m = len - n;
+        memcpy(dst + n, f->buf + offset, m);
+        n += m;
+        f->pos += m;
+    }
+    return n;
+}
+
+/* Files only have a size in blocks, so text ends at the first null byte */
+int fstream_getc(struct fstream* f) {
+    if (fstream_fill(f) < 0) return -1;
+    char c = f->buf[f->pos - f->buf_start * BLOCK_SIZE];
+    if (c == 0) return -1;
+    f->pos++;
+    return (unsigned char)c;
+}
+
+char* fstream_gets(struct fstream* f, char* dst, int len) {
+    int n = 0, c;
+    while (n < len - 1 && (c = fstream_getc(f)) >= 0) {
+        dst[n++] = c;
+        if (c == '\n') break;
+    }
+    dst[n] = 0;
+    return n? dst : NULL;
+}
+
+int fstream_seek(struct fstream* f, unsigned int pos) {
+    if (pos > f->nblocks * BLOCK_SIZE) return -1;
+    f->pos = pos;
+    return 0;
+}
@@ -8,8 +8,16 @@
  * The disk image should be exactly 4MB:
  *     the first 1MB is reserved as 256 frames for memory paging;
  *     the next  1MB contains some ELF binary executables for booting;
- *     the last  2MB is managed by a file system.
+ *     the last  2MB is managed by a file system, which grows over the
+ *     rest of a larger microSD card the image is copied to.
  * The output is in binary format (disk.img).
+ * The file system is a treedisk by default; "./mkfs extentdisk" makes an
+ * extentdisk (see library/file/extent.h) and "./mkfs logdisk" a logdisk
+ * (see library/file/log.h) instead.  A second argument sets the FS block
+ * size of a treedisk or extentdisk in bytes, e.g., "./mkfs treedisk 4096",
+ * which must be BLOCK_SIZE for a logdisk, and a third one the number of
+ * inodes, NINODES by default and at most TREEDISK_MAX_NINODES for a
+ * treedisk, whose inode blocks stay in the memory of the file server.
  */
 
 #include <stdio.h>
@@ -21,14 +29,19 @@
 
 #include "disk.h"
 #include "file.h"
+#include "log.h"
+#include "dir.h"
 
 #define NKERNEL_PROC 5
+#define NEXEC_FILES  (NKERNEL_PROC + 1)
 char* kernel_processes[] = {
                             "../build/release/grass.elf",
                             "../build/release/sys_proc.elf",
                             "../build/release/sys_file.elf",
                             "../build/release/sys_dir.elf",
-                            "../build/release/sys_shell.elf"};
+                            "../build/release/sys_shell.elf",
+                            /* Shared libc executed in place, see library/libc/shared */
+                            "../build/release/libc.bin"};
 
 /* Inode - File/Directory mappings:
 #0: /              #1: /home                #2: /home/yunhao  #3: /home/rvr
@@ -57,11 +70,13 @@ char* contents[] = {
 
 char fs[FS_DISK_SIZE], exec[GRASS_EXEC_SIZE];
 
-void mkfs();
+void mkfs(char* layout, int block_size, int ninodes);
+int make_dir(char* contents, char* buf);
 inode_intf ramdisk_init();
 
-int main() {
-    mkfs();
+int main(int argc, char** argv) {
+    mkfs((argc > 1)? argv[1] : "treedisk", (argc > 2)? atoi(argv[2]) : BLOCK_SIZE,
+         (argc > 3)? atoi(argv[3]) : NINODES);
 
     /* Paging area */
     freopen("disk.img", "w", stdout);
@@ -69,12 +84,16 @@ int main() {
 
     /* Grass kernel processes */
     int exec_size = GRASS_EXEC_SIZE / GRASS_NEXEC;
-    fprintf(stderr, "[INFO] Loading %d kernel binary files\n", NKERNEL_PROC);
+    fprintf(stderr, "[INFO] Loading %d kernel binary files\n", NEXEC_FILES);
 
-    for (int i = 0; i < NKERNEL_PROC; i++) {
+    for (int i = 0; i < NEXEC_FILES; i++) {
         struct stat st;
         stat(kernel_processes[i], &st);
-        assert((st.st_size > 0) && (st.st_size <= exec_size));
+        if (st.st_size <= 0 || st.st_size > exec_size) {
+            fprintf(stderr, "[FATAL] %s: %ld bytes, larger than a %d bytes exec slot\n",
+                    kernel_processes[i], (long)st.st_size, exec_size);
+            exit(1);
+        }
         fprintf(stderr, "[INFO] Loading %s: %ld bytes\n", kernel_processes[i], (long)st.st_size);
 
         freopen(kernel_processes[i], "r", stdin);
@@ -89,7 +108,7 @@ int main() {
         write(1, exec, exec_size - st.st_size);
     }
     memset(exec, 0, GRASS_EXEC_SIZE);
-    write(1, exec, (GRASS_NEXEC - NKERNEL_PROC) * exec_size);
+    write(1, exec, (GRASS_NEXEC - NEXEC_FILES) * exec_size);
         
     /* File system */
     write(1, fs, FS_DISK_SIZE);
@@ -100,21 +119,53 @@ int main() {
 }
 
 
-void mkfs() {
+void mkfs(char* layout, int block_size, int ninodes) {
     inode_intf ramdisk = ramdisk_init();
-    assert(treedisk_create(ramdisk, 0, NINODES) >= 0);
-    inode_intf treedisk = treedisk_init(ramdisk, 0);
+    inode_intf treedisk;
+    int inline_files = 0;
+    assert(ninodes >= NINODE);
+    if (strcmp(layout, "extentdisk") == 0) {
+        fprintf(stderr, "[INFO] Making an extentdisk file system with %d bytes FS blocks and %d inodes\n", block_size, ninodes);
+        assert(extentdisk_create(ramdisk, 0, ninodes, block_size) >= 0);
+        treedisk = extentdisk_init(ramdisk, 0);
+    } else if (strcmp(layout, "logdisk") == 0) {
+        if (block_size != BLOCK_SIZE) {
+            fprintf(stderr, "[FATAL] A logdisk has %d bytes blocks, not %d\n", BLOCK_SIZE, block_size);
+            exit(1);
+        }
+        fprintf(stderr, "[INFO] Making a logdisk file system with %d inodes\n", ninodes);
+        assert(logdisk_create(ramdisk, 0, ninodes) >= 0);
+        treedisk = logdisk_init(ramdisk, 0);
+    } else {
+        inline_files = 1;
+        fprintf(stderr, "[INFO] Making a treedisk file system with %d bytes FS blocks and %d inodes\n", block_size, ninodes);
+        assert(treedisk_create(ramdisk, 0, ninodes, block_size) >= 0);
+        treedisk = treedisk_init(ramdisk, 0);
+
+        /* Mark the inodes below in use in the inode allocation bitmap */
+        for (int ino = 0; ino < NINODE; ino++)
+            assert(treedisk_alloc_inode(treedisk) == ino);
+    }
 
-    char buf[GRASS_EXEC_SIZE / GRASS_NEXEC];
+    static char buf[FS_DISK_SIZE];
     for (int ino = 0; ino < NINODE; ino++) {
-        if (contents[ino][0] != '#') {
-            fprintf(stderr, "[INFO] Loading ino=%d, %ld bytes\n", ino, strlen(contents[ino]));
+        if (contents[ino][0] == '.') {
+            int nblocks = make_dir(contents[ino], buf);
+            int nslots = 1 + ((union dir_block*)buf)->header.nentries;
+            fprintf(stderr, "[INFO] Loading ino=%d, directory of %d blocks%s\n", ino, nblocks,
+                    (inline_files && nblocks == 1 && nslots * sizeof(struct dir_entry) <= TREEDISK_INLINE_SIZE)? " (inline)" : "");
+            for (int b = 0; b < nblocks; b++)
+                treedisk->write(treedisk, ino, b, (void*)(buf + b * BLOCK_SIZE));
+        } else if (contents[ino][0] != '#') {
+            fprintf(stderr, "[INFO] Loading ino=%d, %ld bytes%s\n", ino, strlen(contents[ino]),
+                    (inline_files && strlen(contents[ino]) <= TREEDISK_INLINE_SIZE)? " (inline)" : "");
             strncpy(buf, contents[ino], BLOCK_SIZE);
             treedisk->write(treedisk, ino, 0, (void*)buf);
         } else {
             struct stat st;
             char* file_name = &contents[ino][1];
             stat(file_name, &st);
+            assert(st.st_size <= sizeof(buf));
             
             freopen(file_name, "r", stdin);
             for (int nread = 0; nread < st.st_size; )
@@ -125,9 +176,45 @@ void mkfs() {
                 treedisk->write(treedisk, ino, b, (void*)(buf + b * BLOCK_SIZE));
         }
     }
+
+    /* A logdisk only keeps what a checkpoint points to */
+    if (strcmp(layout, "logdisk") == 0)
+        assert(logdisk_checkpoint(treedisk) >= 0);
 }
 
 
+/* Make a directory in buf (see library/file/dir.h) from the "name ino"
+ * pairs in contents and return its number of blocks.
+ */
+int make_dir(char* contents, char* buf) {
+    char name[32];
+    int ino, len, nentries = 0;
+    for (char* s = contents; sscanf(s, "%31s %d%n", name, &ino, &len) == 2; s += len)
+        nentries++;
+
+    int nblocks = dir_nblocks(nentries);
+    union dir_block* dir = (void*)buf;
+    memset(buf, 0, nblocks * BLOCK_SIZE);
+    dir[0].header.magic = DIR_MAGIC;
+    dir[0].header.nblocks = nblocks;
+    dir[0].header.nentries = nentries;
+
+    for (char* s = contents; sscanf(s, "%31s %d%n", name, &ino, &len) == 2; s += len) {
+        assert(strlen(name) <= DIRENT_NAME_LEN);
+        for (int b = dir_hash(name) % nblocks, full; ; b = (b + 1) % nblocks) {
+            assert(dir_block_find(&dir[b], b, name, &full) < 0);
+            if (full) continue;
+
+            int i = DIR_FIRST_SLOT(b);
+            while (dir[b].entries[i].name[0]) i++;
+            dir[b].entries[i].ino = ino;
+            strncpy(dir[b].entries[i].name, name, DIRENT_NAME_LEN);
+            break;
+        }
+    }
+    return nblocks;
+}
+
 int getsize() { return FS_DISK_SIZE / BLOCK_SIZE; }
 
 int setsize() { assert(0); }
@@ -137,6 +224,11 @@ int ramread(inode_intf bs, unsigned int ino, block_no offset, block_t *block) {
     return 0;
 }
 
+int ramreadv(inode_intf bs, unsigned int ino, block_no offset, block_t *blocks, block_no nblocks) {
+    memcpy(blocks, fs + offset * BLOCK_SIZE, nblocks * BLOCK_SIZE);
+    return 0;
+}
+
 int ramwrite(inode_intf bs, unsigned int ino, block_no offset, block_t *block) {
     memcpy(fs + offset * BLOCK_SIZE, block, BLOCK_SIZE);
     return 0;
@@ -147,8 +239,10 @@ inode_intf ramdisk_init() {
 
     ramdisk->read = (void*)ramread;
     ramdisk->write = (void*)ramwrite;
+    ramdisk->readv = (void*)ramreadv;
     ramdisk->getsize = (void*)getsize;
     ramdisk->setsize = (void*)setsize;
+    ramdisk->sync = NULL;
 
     return ramdisk;
 }
@@ -0,0 +1,177 @@
+/* Description: count the SPI bytes of earth/sd/sd_rw.c
+ * This program links earth/sd/sd_rw.c with a byte-level model of an SD
+ * card in SPI mode in place of earth/sd/sd_spi.c and counts the bytes
+ * clocked over the bus to read and write 8 blocks, one block at a time
+ * (cmd17/cmd24) and all at once (cmd18/acmd23 + cmd25). The model card
+ * needs NAC bytes to access a block and is busy for BUSY bytes after a
+ * block is written; these are card specific, so several are tried.
+ * Build and run with "make sdmodel".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sd.h"
+#include "disk.h"
+#undef printf
+
+#define NBLOCKS     8
+#define QUEUE_SIZE  4096
+
+struct earth *earth, model_earth;
+int nac, busy_time;
+
+/* Bytes clocked over the bus */
+long nbytes;
+
+/* Bytes the model card sends next */
+unsigned char queue[QUEUE_SIZE];
+int queue_head, queue_tail;
+
+/* State of the model card */
+unsigned char disk[NBLOCKS * BLOCK_SIZE], cmd[6];
+unsigned int addr;
+int cmd_len, busy, streaming, writing, multi_write, write_nbytes;
+
+void model_fatal(const char* format, ...) {
+    fprintf(stderr, "[FATAL] sd_rw.c: %s\n", format);
+    exit(1);
+}
+
+void queue_push(int byte, int n) {
+    while (n-- > 0) queue[queue_tail++ % QUEUE_SIZE] = byte;
+}
+
+void send_block() {
+    /* Access time, data token, block and checksum */
+    queue_push(0xFF, nac);
+    queue_push(0xFE, 1);
+    for (int i = 0; i < BLOCK_SIZE; i++)
+        queue_push(disk[(addr % NBLOCKS) * BLOCK_SIZE + i], 1);
+    queue_push(0x00, 2);
+    addr++;
+}
+
+void exec_cmd() {
+    int index = cmd[0] & 0x3F;
+    addr = (cmd[1] << 24) | (cmd[2] << 16) | (cmd[3] << 8) | cmd[4];
+
+    if (index == 12) {
+        /* Stop a multi-block read: stuff byte, reply and busy */
+        streaming = 0;
+        queue_head = queue_tail = 0;
+        queue_push(0xFF, 1);
+        queue_push(0x00, 1);
+        busy = 1;
+        return;
+    }
+
+    /* Reply after one byte; cmd55 replies "idle" like a real card */
+    queue_push(0xFF, 1);
+    queue_push(index == 55 ? 0x01 : 0x00, 1);
+    if (index == 17) send_block();
+    if (index == 18) streaming = 1;
+    if (index == 24 || index == 25) {
+        writing = 1;
+        multi_write = (index == 25);
+        write_nbytes = 0;
+    }
+}
+
+char transfer(char tx) {
+    int rx, byte = (unsigned char)tx;
+    nbytes++;
+
+    if (queue_head != queue_tail)
+        rx = queue[queue_head++ % QUEUE_SIZE];
+    else if (busy > 0) {
+        busy--;
+        rx = 0x00;
+    } else if (streaming) {
+        send_block();
+        rx = queue[queue_head++ % QUEUE_SIZE];
+    } else
+        rx = 0xFF;
+
+    if (writing) {
+        /* Data packet: token, block and checksum, then the data ack */
+        if (write_nbytes > 0) {
+            if (--write_nbytes == 0) {
+                queue_push(0x05, 1);
+                busy = busy_time;
+                if (!multi_write) writing = 0;
+            }
+        } else if (byte == 0xFC || byte == 0xFE) {
+            write_nbytes = BLOCK_SIZE + 2;
+        } else if (byte == 0xFD) {
+            queue_push(0xFF, 1);
+            busy = busy_time;
+            writing = 0;
+        }
+    } else if (cmd_len > 0 || (byte & 0xC0) == 0x40) {
+        cmd[cmd_len++] = byte;
+        if (cmd_len == 6) {
+            cmd_len = 0;
+            exec_cmd();
+        }
+    }
+    return rx;
+}
+
+/* The interface of earth/sd/sd_spi.c */
+char send_data_byte(char byte) { return transfer(byte); }
+
+char recv_data_byte() { return transfer(0xFF); }
+
+void sd_transfer(char* tx, char* rx, int len) {
+    for (int i = 0; i < len; i++) {
+        char byte = transfer(tx ? tx[i] : 0xFF);
+        if (rx) rx[i] = byte;
+    }
+}
+
+char sd_exec_cmd(char* cmd) {
+    char reply;
+    for (int i = 0; i < 6; i++) send_data_byte(cmd[i]);
+    while ((reply = recv_data_byte()) == 0xFF);
+    return reply;
+}
+
+char sd_exec_acmd(char* cmd) {
+    char cmd55[] = {0x77, 0x00, 0x00, 0x00, 0x00, 0xFF};
+    while (recv_data_byte() != 0xFF);
+    sd_exec_cmd(cmd55);
+    while (recv_data_byte() != 0xFF);
+    return sd_exec_cmd(cmd);
+}
+
+long count(int (*rw)(int, int, char*), int nblock, char* buf) {
+    nbytes = 0;
+    for (int b = 0; b < NBLOCKS; b += nblock)
+        rw(b, nblock, buf + b * BLOCK_SIZE);
+    return nbytes;
+}
+
+int main() {
+    earth = &model_earth;
+    earth->tty_fatal = (void*)model_fatal;
+    for (int i = 0; i < sizeof(disk); i++) disk[i] = rand();
+
+    char buf[NBLOCKS * BLOCK_SIZE];
+    int nacs[] = {0, 100, 1000}, busy_times[] = {0, 250, 2500};
+    for (int i = 0; i < 3; i++) {
+        nac = nacs[i];
+        busy_time = busy_times[i];
+
+        long read1 = count(sdread, 1, buf);
+        long readn = count(sdread, NBLOCKS, buf);
+        if (memcmp(buf, disk, sizeof(buf))) model_fatal("data read differs");
+        long write1 = count(sdwrite, 1, buf);
+        long writen = count(sdwrite, NBLOCKS, buf);
+
+        printf("[INFO] NAC=%d BUSY=%d: read %dx1 %ld bytes, 1x%d %ld; write %dx1 %ld, 1x%d %ld\n",
+               nac, busy_time, NBLOCKS, read1, NBLOCKS, readn,
+               NBLOCKS, write1, NBLOCKS, writen);
+    }
+    return 0;
+}